@@ -0,0 +1,416 @@
+//
+// stew_bench - end-to-end throughput of the stew pipeline stages.
+//
+// Generates reproducible short- and long-read datasets, runs them through
+// decompression, parsing, scoring and writing for every combination of the
+// -k/-p/-c/-t values given, and reports reads/s, MB/s and ns/k-mer per stage
+// as JSON so runs can be compared. With several scoring engines (-e), every
+// run also reports how far its selection overlaps that of the first engine.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include <ketopt.h>
+#include <kseq.h>
+#include <batch.h>
+#include <stew.h>
+
+#include "synth.h"
+
+#define BENCH_MAX_VALUES 16
+
+// parse in-memory FASTQ with the same kseq code the CLI uses on gz files
+typedef struct membuf_s {
+    const char *data;
+    size_t l, pos;
+} membuf_t;
+
+static int membuf_read(membuf_t *mb, char *buf, int len)
+{
+    size_t left = mb->l - mb->pos;
+    size_t n = left < (size_t)len ? left : (size_t)len;
+    memcpy(buf, mb->data + mb->pos, n);
+    mb->pos += n;
+    return (int)n;
+}
+
+KSEQ_INIT(membuf_t *, membuf_read);
+
+static ko_longopt_t bench_longopts[] = {
+        { "kmers", ko_required_argument, 'k' },
+        { "platters", ko_required_argument, 'p' },
+        { "cups", ko_required_argument, 'c' },
+        { "threads", ko_required_argument, 't' },
+        { "engines", ko_required_argument, 'e' },
+        { "short-reads", ko_required_argument, 'n' },
+        { "long-reads", ko_required_argument, 'l' },
+        { "dup", ko_required_argument, 'd' },
+        { "seed", ko_required_argument, 's' },
+        { "workdir", ko_required_argument, 'w' },
+        { "output", ko_required_argument, 'o' },
+        { "help", ko_no_argument, 'h' },
+        { NULL, 0, 0 }
+};
+
+static const char *usage =
+        "Usage: stew_bench [options]\n"
+        "\t-k (--kmers) - Comma separated kmer sizes [Default: 23]\n"
+        "\t-p (--platters) - Comma separated platter counts [Default: 10]\n"
+        "\t-c (--cups) - Comma separated cup counts [Default: 8,12]\n"
+        "\t-t (--threads) - Comma separated thread counts [Default: 1,4]\n"
+        "\t-e (--engines) - Comma separated scoring engines, hll, cms, delta or exact; the others' "
+        "selections are compared to the first's [Default: hll]\n"
+        "\t-n (--short-reads) - Number of 150 bp reads [Default: 20000]\n"
+        "\t-l (--long-reads) - Number of ~10 kb reads [Default: 100]\n"
+        "\t-d (--dup) - Fraction of exactly duplicated reads [Default: 0.1]\n"
+        "\t-s (--seed) - Seed of the read generator [Default: 42]\n"
+        "\t-w (--workdir) - Directory for the temporary datasets [Default: /tmp]\n"
+        "\t-o (--output) - JSON report [Default: stdout]\n";
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// parse "a,b,c" into vals, returns the number of values
+static int parse_list(const char *arg, int *vals)
+{
+    int n = 0;
+    const char *s = arg;
+    while (*s && n < BENCH_MAX_VALUES)
+    {
+        char *end;
+        vals[n++] = (int)strtol(s, &end, 10);
+        if (*end != ',') break;
+        s = end + 1;
+    }
+    return n;
+}
+
+static const char *engine_names[] = {
+        [STEW_ENGINE_HLL] = "hll", [STEW_ENGINE_CMS] = "cms", [STEW_ENGINE_DELTA] = "delta",
+        [STEW_ENGINE_EXACT] = "exact"
+};
+
+// parse "hll,delta" into engines, returns the number of engines, 0 if one
+// isn't known
+static int parse_engines(const char *arg, int *vals)
+{
+    int n = 0;
+    const char *s = arg;
+    while (*s && n < BENCH_MAX_VALUES)
+    {
+        size_t l = strcspn(s, ",");
+        int e = -1;
+        for (int i = 0; i < (int)(sizeof(engine_names) / sizeof(engine_names[0])); i++)
+        {
+            if (strlen(engine_names[i]) == l && !strncmp(s, engine_names[i], l)) e = i;
+        }
+        if (e < 0) return 0;
+        vals[n++] = e;
+        if (s[l] != ',') break;
+        s += l + 1;
+    }
+    return n;
+}
+
+typedef struct bench_data_s {
+    const char *name;
+    synth_summary_t summary;
+    read_batch_t **batches;
+    size_t n_batches;
+    double t_decompress, t_parse;
+} bench_data_t;
+
+// generate a dataset, then time decompressing and parsing it into batches
+static int bench_load(bench_data_t *bd, const synth_params_t *sp, const char *path)
+{
+    if (!synth_write_fastq(sp, path, &bd->summary))
+    {
+        fprintf(stderr, "Couldn't write %s\n", path);
+        return 0;
+    }
+
+    double t0 = bench_now();
+    gzFile fp = gzopen(path, "r");
+    char *data = (char *)malloc(bd->summary.bytes + 1);
+    if (!fp || !data)
+    {
+        free(data);
+        if (fp) gzclose(fp);
+        return 0;
+    }
+    size_t l = 0;
+    int r;
+    while (l < bd->summary.bytes &&
+           (r = gzread(fp, data + l, (unsigned)(bd->summary.bytes - l))) > 0)
+    {
+        l += r;
+    }
+    gzclose(fp);
+    bd->t_decompress = bench_now() - t0;
+
+    t0 = bench_now();
+    membuf_t mb = { data, l, 0 };
+    kseq_t *seq = kseq_init(&mb);
+    size_t m = 0;
+    for (;;)
+    {
+        if (bd->n_batches == m)
+        {
+            m = m ? m << 1 : 16;
+            bd->batches = (read_batch_t **)realloc(bd->batches, m * sizeof(read_batch_t *));
+        }
+        read_batch_t *rb = read_batch_init(0, 0);
+        while (!read_batch_full(rb) && kseq_read(seq) >= 0)
+        {
+            read_batch_push(rb, &seq->name, &seq->comment, &seq->seq, &seq->qual);
+        }
+        read_batch_seal(rb);
+        if (!rb->n)
+        {
+            read_batch_destroy(rb);
+            break;
+        }
+        bd->batches[bd->n_batches++] = rb;
+    }
+    kseq_destroy(seq);
+    bd->t_parse = bench_now() - t0;
+
+    free(data);
+    return 1;
+}
+
+static void bench_release(bench_data_t *bd)
+{
+    for (size_t i = 0; i < bd->n_batches; i++)
+    {
+        read_batch_destroy(bd->batches[i]);
+    }
+    free(bd->batches);
+}
+
+static void json_stage(FILE *fp, const char *name, double sec, size_t reads, size_t bytes,
+                       size_t kmers, int last)
+{
+    fprintf(fp, "        \"%s\": {\"seconds\": %.6f, \"reads_per_s\": %.1f, "
+                "\"mb_per_s\": %.2f, \"ns_per_kmer\": %.3f}%s\n",
+            name, sec, sec > 0 ? reads / sec : 0, sec > 0 ? bytes / sec / 1e6 : 0,
+            kmers ? sec * 1e9 / kmers : 0, last ? "" : ",");
+}
+
+// room for every k-mer of a dataset in the exact engine's sets, at half load
+static int bench_exact_mb(const bench_data_t *bd)
+{
+    size_t bases = bd->summary.n_bases;
+    return (int)((bases * 2 * sizeof(uint64_t) >> 20) + 1);
+}
+
+// Jaccard similarity of the reads two runs selected
+static double bench_overlap(const bench_data_t *bd, const uint8_t *a, const uint8_t *b)
+{
+    size_t both = 0, either = 0;
+    for (size_t i = 0; i < bd->n_batches; i++)
+    {
+        for (size_t j = 0; j < bd->batches[i]->n; j++)
+        {
+            size_t r = i * READ_BATCH_MAX_READS + j;
+            both += a[r] & b[r] & 1;
+            either += (a[r] | b[r]) & 1;
+        }
+    }
+    return either ? (double)both / either : 1;
+}
+
+// score and write a loaded dataset with one parameter combination, leaving
+// the keep masks of every batch in masks; ref, if not NULL, holds those of
+// the run to compare the selection to
+static int bench_run(FILE *json, const bench_data_t *bd, const stew_params_t *sp,
+                     const char *out_path, int first, uint8_t *masks, const uint8_t *ref)
+{
+    stew_ctx_t *ctx = stew_ctx_create(sp);
+    FILE *out = fopen(out_path, "w");
+    if (!ctx || !out)
+    {
+        fprintf(stderr, "Couldn't set up run k=%d p=%d c=%d t=%d engine=%s\n",
+                sp->kmer, sp->platters, sp->cups, sp->threads, engine_names[sp->engine]);
+        stew_ctx_destroy(ctx);
+        if (out) fclose(out);
+        return 0;
+    }
+
+    size_t kmers = 0;
+    for (size_t b = 0; b < bd->n_batches; b++)
+    {
+        for (size_t i = 0; i < bd->batches[b]->n; i++)
+        {
+            size_t len = bd->batches[b]->lens[i];
+            kmers += len >= (size_t)sp->kmer ? len - sp->kmer + 1 : 0;
+        }
+    }
+
+    // keep masks of every batch, so writing can be timed on its own
+    double t0 = bench_now();
+    for (size_t b = 0; b < bd->n_batches; b++)
+    {
+        const read_batch_t *rb = bd->batches[b];
+        stew_score_batch(ctx, rb->seqs, rb->lens, rb->n, masks + b * READ_BATCH_MAX_READS);
+    }
+    double t_score = bench_now() - t0;
+
+    t0 = bench_now();
+    size_t bytes_out = 0;
+    for (size_t b = 0; b < bd->n_batches; b++)
+    {
+        read_batch_write(bd->batches[b], masks + b * READ_BATCH_MAX_READS, out);
+    }
+    fflush(out);
+    bytes_out = ftell(out);
+    double t_write = bench_now() - t0;
+    fclose(out);
+    remove(out_path);
+
+    size_t reads = bd->summary.n_reads, bytes = bd->summary.bytes;
+    fprintf(json, "%s    {\"dataset\": \"%s\", \"reads\": %zu, \"bases\": %zu, \"bytes\": %zu, "
+                  "\"duplicates\": %zu,\n",
+            first ? "" : ",\n", bd->name, reads, bd->summary.n_bases, bytes, bd->summary.n_dups);
+    fprintf(json, "      \"k\": %d, \"p\": %d, \"c\": %d, \"t\": %d, \"engine\": \"%s\", "
+                  "\"kmers\": %zu, \"selected\": %llu, \"bytes_out\": %zu,\n",
+            sp->kmer, sp->platters, sp->cups, sp->threads, engine_names[sp->engine], kmers,
+            (unsigned long long)stew_ctx_selected(ctx), bytes_out);
+    if (ref)
+    {
+        fprintf(json, "      \"overlap\": %.4f,\n", bench_overlap(bd, masks, ref));
+    }
+    fprintf(json, "      \"stages\": {\n");
+    json_stage(json, "decompress", bd->t_decompress, reads, bytes, kmers, 0);
+    json_stage(json, "parse", bd->t_parse, reads, bytes, kmers, 0);
+    json_stage(json, "score", t_score, reads, bytes, kmers, 0);
+    json_stage(json, "write", t_write, reads, bytes, kmers, 0);
+    json_stage(json, "total", bd->t_decompress + bd->t_parse + t_score + t_write,
+               reads, bytes, kmers, 1);
+    fprintf(json, "      }}");
+
+    fprintf(stderr, "%-5s k=%-3d p=%-2d c=%-2d t=%-2d %-5s %10.0f reads/s %8.2f MB/s %8.3f ns/kmer "
+                    "(score) %8llu selected",
+            bd->name, sp->kmer, sp->platters, sp->cups, sp->threads, engine_names[sp->engine],
+            reads / t_score, bytes / t_score / 1e6, t_score * 1e9 / (kmers ? kmers : 1),
+            (unsigned long long)stew_ctx_selected(ctx));
+    if (ref)
+    {
+        fprintf(stderr, " %.4f overlap", bench_overlap(bd, masks, ref));
+    }
+    fprintf(stderr, "\n");
+
+    stew_ctx_destroy(ctx);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    int ks[BENCH_MAX_VALUES] = { 23 }, ps[BENCH_MAX_VALUES] = { 10 };
+    int cs[BENCH_MAX_VALUES] = { 8, 12 }, ts[BENCH_MAX_VALUES] = { 1, 4 };
+    int es[BENCH_MAX_VALUES] = { STEW_ENGINE_HLL };
+    int nk = 1, np = 1, nc = 2, nt = 2, ne = 1;
+    size_t n_short = 20000, n_long = 100;
+    double dup = 0.1;
+    uint64_t seed = 42;
+    const char *workdir = "/tmp", *output = NULL;
+
+    ketopt_t o = KETOPT_INIT;
+    int c;
+    while ((c = ketopt(&o, argc, argv, 1, "k:p:c:t:e:n:l:d:s:w:o:h", bench_longopts)) >= 0)
+    {
+        if (c == 'k') nk = parse_list(o.arg, ks);
+        else if (c == 'p') np = parse_list(o.arg, ps);
+        else if (c == 'c') nc = parse_list(o.arg, cs);
+        else if (c == 't') nt = parse_list(o.arg, ts);
+        else if (c == 'e' && (ne = parse_engines(o.arg, es))) continue;
+        else if (c == 'n') n_short = strtoull(o.arg, NULL, 10);
+        else if (c == 'l') n_long = strtoull(o.arg, NULL, 10);
+        else if (c == 'd') dup = atof(o.arg);
+        else if (c == 's') seed = strtoull(o.arg, NULL, 10);
+        else if (c == 'w') workdir = o.arg;
+        else if (c == 'o') output = o.arg;
+        else
+        {
+            fprintf(stderr, "%s", usage);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+
+    FILE *json = output ? fopen(output, "w") : stdout;
+    if (!json)
+    {
+        fprintf(stderr, "Couldn't open %s\n", output);
+        return 1;
+    }
+
+    char in_path[4096], out_path[4096];
+    snprintf(out_path, sizeof(out_path), "%s/stew_bench_out.fq", workdir);
+
+    fprintf(json, "{\"stew_bench\": {\"seed\": %llu, \"dup_rate\": %.4f, \"runs\": [\n",
+            (unsigned long long)seed, dup);
+    int first = 1, ok = 1;
+    for (int d = 0; d < 2 && ok; d++)
+    {
+        synth_params_t syn;
+        bench_data_t bd;
+        memset(&bd, 0, sizeof(bd));
+        if (d == 0)
+        {
+            if (!n_short) continue;
+            synth_params_short(&syn, n_short, dup, seed);
+            bd.name = "short";
+        }
+        else
+        {
+            if (!n_long) continue;
+            synth_params_long(&syn, n_long, dup, seed);
+            bd.name = "long";
+        }
+        snprintf(in_path, sizeof(in_path), "%s/stew_bench_%s.fq.gz", workdir, bd.name);
+        ok = bench_load(&bd, &syn, in_path);
+        remove(in_path);
+        // the first engine's masks, and those of the others
+        uint8_t *masks[2] = { NULL, NULL };
+        if (ok)
+        {
+            masks[0] = (uint8_t *)malloc(bd.n_batches * READ_BATCH_MAX_READS);
+            masks[1] = (uint8_t *)malloc(bd.n_batches * READ_BATCH_MAX_READS);
+            ok = masks[0] && masks[1];
+        }
+
+        for (int a = 0; a < nk && ok; a++)
+            for (int b = 0; b < np && ok; b++)
+                for (int e = 0; e < nc && ok; e++)
+                    for (int f = 0; f < nt && ok; f++)
+                        for (int g = 0; g < ne && ok; g++)
+                        {
+                            stew_params_t sp;
+                            stew_params_default(&sp);
+                            sp.kmer = ks[a];
+                            sp.platters = ps[b];
+                            sp.cups = cs[e];
+                            sp.threads = ts[f];
+                            sp.engine = es[g];
+                            sp.exact_mb = bench_exact_mb(&bd);
+                            ok = bench_run(json, &bd, &sp, out_path, first, masks[g > 0],
+                                           g > 0 ? masks[0] : NULL);
+                            first = 0;
+                        }
+        free(masks[0]);
+        free(masks[1]);
+        bench_release(&bd);
+    }
+    fprintf(json, "\n]}}\n");
+
+    if (output) fclose(json);
+    return ok ? 0 : 1;
+}
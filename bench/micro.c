@@ -0,0 +1,362 @@
+//
+// stew_microbench - cycles per operation of the HLL and hashing kernels.
+//
+// Covers hll_add() at every bucket_bits value, hll_get_estimate() against the
+// register count, hll_merge() bandwidth and CityHash64() against other
+// hashes at k-mer sized inputs. Every kernel is measured with warm caches
+// (small working set, repeated) and cold caches (caches evicted before each
+// short burst of operations).
+//
+// Cycles come from the TSC where there is one (reference cycles, not core
+// cycles), otherwise nanoseconds are reported.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MICRO_UNIT "cycles"
+static inline uint64_t micro_ticks(void)
+{
+    return __rdtsc();
+}
+#else
+#define MICRO_UNIT "ns"
+static inline uint64_t micro_ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#include <ketopt.h>
+#include <hll.h>
+#include <city.h>
+
+#include "synth.h"
+
+#define MICRO_EVICT_BYTES (64 << 20)
+#define MICRO_COLD_BURST 64
+
+static ko_longopt_t micro_longopts[] = {
+        { "iterations", ko_required_argument, 'i' },
+        { "seed", ko_required_argument, 's' },
+        { "output", ko_required_argument, 'o' },
+        { "help", ko_no_argument, 'h' },
+        { NULL, 0, 0 }
+};
+
+static const char *usage =
+        "Usage: stew_microbench [options]\n"
+        "\t-i (--iterations) - Operations per warm measurement [Default: 1000000]\n"
+        "\t-s (--seed) - Seed of the input generator [Default: 42]\n"
+        "\t-o (--output) - JSON report [Default: stdout]\n";
+
+// alternative hashes to compare CityHash64 against
+static uint64_t fnv1a64(const char *s, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// MurmurHash64A, Austin Appleby (public domain)
+static uint64_t murmur64a(const char *key, size_t len)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = 0x8445d61a4e774912ULL ^ (len * m);
+    const char *end = key + (len & ~(size_t)7);
+    for (const char *p = key; p != end; p += 8)
+    {
+        uint64_t k;
+        memcpy(&k, p, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    const unsigned char *t = (const unsigned char *)end;
+    switch (len & 7)
+    {
+        case 7: h ^= (uint64_t)t[6] << 48; /* fall through */
+        case 6: h ^= (uint64_t)t[5] << 40; /* fall through */
+        case 5: h ^= (uint64_t)t[4] << 32; /* fall through */
+        case 4: h ^= (uint64_t)t[3] << 24; /* fall through */
+        case 3: h ^= (uint64_t)t[2] << 16; /* fall through */
+        case 2: h ^= (uint64_t)t[1] << 8; /* fall through */
+        case 1: h ^= (uint64_t)t[0];
+            h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+typedef struct micro_hash_s {
+    const char *name;
+    hll_hash_function_t fn;
+} micro_hash_t;
+
+static const micro_hash_t micro_hashes[] = {
+        { "CityHash64", CityHash64 },
+        { "MurmurHash64A", murmur64a },
+        { "FNV-1a", fnv1a64 },
+};
+
+static volatile uint64_t micro_sink;
+static unsigned char *evict_buf;
+
+// push the working set out of every cache level
+static void micro_evict(void)
+{
+    uint64_t s = 0;
+    for (size_t i = 0; i < MICRO_EVICT_BYTES; i += 64)
+    {
+        evict_buf[i]++;
+        s += evict_buf[i];
+    }
+    micro_sink += s;
+}
+
+static int micro_first = 1;
+
+static void micro_report(FILE *json, const char *kernel, const char *variant, long param,
+                         const char *cache, double per_op, double bytes_per_op)
+{
+    fprintf(json, "%s    {\"kernel\": \"%s\", \"variant\": \"%s\", \"param\": %ld, "
+                  "\"cache\": \"%s\", \"%s_per_op\": %.2f",
+            micro_first ? "" : ",\n", kernel, variant, param, cache, MICRO_UNIT, per_op);
+    if (bytes_per_op > 0)
+    {
+        fprintf(json, ", \"bytes_per_%s\": %.3f", MICRO_UNIT, bytes_per_op / per_op);
+    }
+    fprintf(json, "}");
+    micro_first = 0;
+    fprintf(stderr, "%-18s %-14s %6ld %-5s %10.2f %s/op\n",
+            kernel, variant, param, cache, per_op, MICRO_UNIT);
+}
+
+// hashes and random k-mers generated up front, so only the kernel is timed
+static char *kmer_pool;
+static size_t kmer_pool_l;
+
+static void bench_hash(FILE *json, size_t iters, uint64_t *seed)
+{
+    static const size_t lens[] = { 15, 23, 31, 50, 75, 100 };
+    for (size_t h = 0; h < sizeof(micro_hashes) / sizeof(micro_hashes[0]); h++)
+    {
+        for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++)
+        {
+            size_t len = lens[l];
+            hll_hash_function_t fn = micro_hashes[h].fn;
+
+            // warm: slide over a 4 kb window that stays in L1
+            uint64_t acc = 0, t0 = micro_ticks();
+            for (size_t i = 0; i < iters; i++)
+            {
+                acc += fn(kmer_pool + (i & 4095), len);
+            }
+            double warm = (double)(micro_ticks() - t0) / iters;
+
+            // cold: short bursts at random spots of the pool after evicting
+            uint64_t ticks = 0;
+            size_t ops = 0;
+            for (size_t r = 0; ops < iters / 64; r++)
+            {
+                size_t base = synth_rand(seed) % (kmer_pool_l - 4096 - len);
+                micro_evict();
+                t0 = micro_ticks();
+                for (size_t i = 0; i < MICRO_COLD_BURST; i++)
+                {
+                    acc += fn(kmer_pool + base + i * 61, len);
+                }
+                ticks += micro_ticks() - t0;
+                ops += MICRO_COLD_BURST;
+            }
+            micro_sink += acc;
+            micro_report(json, "hash", micro_hashes[h].name, len, "warm", warm, len);
+            micro_report(json, "hash", micro_hashes[h].name, len, "cold", (double)ticks / ops, len);
+        }
+    }
+}
+
+static void bench_hll_add(FILE *json, size_t iters, uint64_t *seed)
+{
+    uint64_t *hashes = (uint64_t *)malloc(iters * sizeof(uint64_t));
+    for (size_t i = 0; i < iters; i++)
+    {
+        hashes[i] = synth_rand(seed);
+    }
+
+    for (size_t bits = 4; bits <= 16; bits++)
+    {
+        hll_t *hll = hll_create(bits);
+
+        // warm: k-mer hashing plus the register update, then the update alone
+        uint64_t t0 = micro_ticks();
+        for (size_t i = 0; i < iters; i++)
+        {
+            hll_add(hll, kmer_pool + (i & 4095), 23);
+        }
+        double warm = (double)(micro_ticks() - t0) / iters;
+
+        t0 = micro_ticks();
+        for (size_t i = 0; i < iters; i++)
+        {
+            hll_add_hash(hll, hashes[i]);
+        }
+        double warm_hash = (double)(micro_ticks() - t0) / iters;
+
+        // cold: the platter has been evicted between bursts
+        uint64_t ticks = 0;
+        size_t ops = 0;
+        for (size_t r = 0; ops < iters / 64; r++)
+        {
+            micro_evict();
+            t0 = micro_ticks();
+            for (size_t i = 0; i < MICRO_COLD_BURST; i++)
+            {
+                hll_add_hash(hll, hashes[(ops + i) % iters]);
+            }
+            ticks += micro_ticks() - t0;
+            ops += MICRO_COLD_BURST;
+        }
+
+        micro_report(json, "hll_add", "kmer23", bits, "warm", warm, 0);
+        micro_report(json, "hll_add_hash", "precomputed", bits, "warm", warm_hash, 0);
+        micro_report(json, "hll_add_hash", "precomputed", bits, "cold", (double)ticks / ops, 0);
+        hll_release(hll);
+    }
+    free(hashes);
+}
+
+static void bench_hll_estimate(FILE *json, size_t iters, uint64_t *seed)
+{
+    for (size_t bits = 4; bits <= 16; bits++)
+    {
+        hll_t *hll = hll_create(bits);
+        size_t n = (size_t)1 << bits;
+        for (size_t i = 0; i < 4 * n; i++)
+        {
+            hll_add_hash(hll, synth_rand(seed));
+        }
+
+        size_t reps = iters / n < 16 ? 16 : iters / n;
+        hll_estimate_t est;
+        uint64_t acc = 0, t0 = micro_ticks();
+        for (size_t i = 0; i < reps; i++)
+        {
+            hll_get_estimate(hll, &est);
+            acc += est.estimate;
+        }
+        double warm = (double)(micro_ticks() - t0) / reps;
+
+        uint64_t ticks = 0;
+        for (size_t i = 0; i < 16; i++)
+        {
+            micro_evict();
+            t0 = micro_ticks();
+            hll_get_estimate(hll, &est);
+            ticks += micro_ticks() - t0;
+            acc += est.estimate;
+        }
+        micro_sink += acc;
+        micro_report(json, "hll_get_estimate", "registers", n, "warm", warm, 0);
+        micro_report(json, "hll_get_estimate", "registers", n, "cold", ticks / 16.0, 0);
+        hll_release(hll);
+    }
+}
+
+static void bench_hll_merge(FILE *json, size_t iters, uint64_t *seed)
+{
+    for (size_t bits = 4; bits <= 16; bits++)
+    {
+        hll_t *a = hll_create(bits), *b = hll_create(bits);
+        size_t n = (size_t)1 << bits;
+        for (size_t i = 0; i < 2 * n; i++)
+        {
+            hll_add_hash(a, synth_rand(seed));
+            hll_add_hash(b, synth_rand(seed));
+        }
+
+        size_t reps = iters / n < 16 ? 16 : iters / n;
+        uint64_t t0 = micro_ticks();
+        for (size_t i = 0; i < reps; i++)
+        {
+            hll_merge(a, b);
+        }
+        double warm = (double)(micro_ticks() - t0) / reps;
+
+        uint64_t ticks = 0;
+        for (size_t i = 0; i < 16; i++)
+        {
+            micro_evict();
+            t0 = micro_ticks();
+            hll_merge(a, b);
+            ticks += micro_ticks() - t0;
+        }
+        // bandwidth counts both platters read and one written
+        micro_report(json, "hll_merge", "registers", n, "warm", warm, 3.0 * n);
+        micro_report(json, "hll_merge", "registers", n, "cold", ticks / 16.0, 3.0 * n);
+        hll_release(a);
+        hll_release(b);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t iters = 1000000;
+    uint64_t seed = 42;
+    const char *output = NULL;
+
+    ketopt_t o = KETOPT_INIT;
+    int c;
+    while ((c = ketopt(&o, argc, argv, 1, "i:s:o:h", micro_longopts)) >= 0)
+    {
+        if (c == 'i') iters = strtoull(o.arg, NULL, 10);
+        else if (c == 's') seed = strtoull(o.arg, NULL, 10);
+        else if (c == 'o') output = o.arg;
+        else
+        {
+            fprintf(stderr, "%s", usage);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (iters < MICRO_COLD_BURST * 16) iters = MICRO_COLD_BURST * 16;
+
+    FILE *json = output ? fopen(output, "w") : stdout;
+    evict_buf = (unsigned char *)calloc(MICRO_EVICT_BYTES, 1);
+    kmer_pool_l = 64 << 20;
+    kmer_pool = (char *)malloc(kmer_pool_l);
+    if (!json || !evict_buf || !kmer_pool)
+    {
+        fprintf(stderr, "Couldn't set up the benchmark\n");
+        return 1;
+    }
+    synth_random_seq(&seed, kmer_pool, kmer_pool_l);
+
+    fprintf(json, "{\"stew_microbench\": {\"unit\": \"%s\", \"iterations\": %zu, \"results\": [\n",
+            MICRO_UNIT, iters);
+    bench_hash(json, iters, &seed);
+    bench_hll_add(json, iters, &seed);
+    bench_hll_estimate(json, iters, &seed);
+    bench_hll_merge(json, iters, &seed);
+    fprintf(json, "\n]}}\n");
+
+    if (output) fclose(json);
+    free(evict_buf);
+    free(kmer_pool);
+    return 0;
+}
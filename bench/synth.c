@@ -0,0 +1,127 @@
+//
+// Reproducible synthetic read datasets for the stew benchmarks.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "synth.h"
+
+static const char bases[4] = { 'A', 'C', 'G', 'T' };
+
+void synth_random_seq(uint64_t *state, char *buf, size_t len)
+{
+    size_t i = 0;
+    while (i < len)
+    {
+        uint64_t r = synth_rand(state);
+        for (int j = 0; j < 32 && i < len; j++, i++, r >>= 2)
+        {
+            buf[i] = bases[r & 3];
+        }
+    }
+}
+
+void synth_params_short(synth_params_t *sp, size_t n_reads, double dup_rate, uint64_t seed)
+{
+    sp->seed = seed;
+    sp->genome_len = 5000000;
+    sp->n_reads = n_reads;
+    sp->read_len = 150;
+    sp->long_reads = 0;
+    sp->dup_rate = dup_rate;
+    sp->error_rate = 0.001;
+}
+
+void synth_params_long(synth_params_t *sp, size_t n_reads, double dup_rate, uint64_t seed)
+{
+    sp->seed = seed;
+    sp->genome_len = 5000000;
+    sp->n_reads = n_reads;
+    sp->read_len = 10000;
+    sp->long_reads = 1;
+    sp->dup_rate = dup_rate;
+    sp->error_rate = 0.01;
+}
+
+static double synth_unit(uint64_t *state)
+{
+    return (synth_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int synth_write_fastq(const synth_params_t *sp, const char *path, synth_summary_t *summary)
+{
+    uint64_t state = sp->seed;
+    size_t max_len = sp->long_reads ? sp->read_len + sp->read_len / 2 : sp->read_len;
+    if (max_len > sp->genome_len) max_len = sp->genome_len;
+
+    char *genome = (char *)malloc(sp->genome_len);
+    char *seq = (char *)malloc(max_len + 1);
+    char *qual = (char *)malloc(max_len + 1);
+    // reads are remembered by (start, length, seed) so duplicates can be
+    // regenerated exactly without keeping their sequence around
+    uint64_t *hist = (uint64_t *)malloc(sp->n_reads * 3 * sizeof(uint64_t));
+    gzFile fp = gzopen(path, "wb1");
+    if (!genome || !seq || !qual || !hist || !fp)
+    {
+        free(genome); free(seq); free(qual); free(hist);
+        if (fp) gzclose(fp);
+        return 0;
+    }
+    synth_random_seq(&state, genome, sp->genome_len);
+    memset(summary, 0, sizeof(*summary));
+
+    for (size_t r = 0; r < sp->n_reads; r++)
+    {
+        uint64_t start, len, rseed;
+        if (r && synth_unit(&state) < sp->dup_rate)
+        {
+            size_t src = synth_rand(&state) % r;
+            start = hist[3 * src];
+            len = hist[3 * src + 1];
+            rseed = hist[3 * src + 2];
+            summary->n_dups++;
+        }
+        else
+        {
+            len = sp->long_reads ? sp->read_len / 2 + synth_rand(&state) % (sp->read_len + 1)
+                                 : sp->read_len;
+            if (len > max_len) len = max_len;
+            start = synth_rand(&state) % (sp->genome_len - len + 1);
+            rseed = synth_rand(&state);
+        }
+        hist[3 * r] = start;
+        hist[3 * r + 1] = len;
+        hist[3 * r + 2] = rseed;
+
+        memcpy(seq, genome + start, len);
+        uint64_t rs = rseed;
+        for (size_t i = 0; i < len; i++)
+        {
+            if (synth_unit(&rs) < sp->error_rate)
+            {
+                seq[i] = bases[synth_rand(&rs) & 3];
+            }
+            qual[i] = (char)('5' + synth_rand(&rs) % 10);
+        }
+        seq[len] = qual[len] = '\n';
+
+        // gzprintf() is limited to the gz buffer size, long reads aren't
+        int w = gzprintf(fp, "@read%zu synth\n", r);
+        if (w <= 0 || gzwrite(fp, seq, len + 1) <= 0 || gzwrite(fp, "+\n", 2) <= 0 ||
+            gzwrite(fp, qual, len + 1) <= 0)
+        {
+            break;
+        }
+        summary->bytes += w + 2 * (len + 1) + 2;
+        summary->n_bases += len;
+        summary->n_reads++;
+    }
+
+    free(genome);
+    free(seq);
+    free(qual);
+    free(hist);
+    return gzclose(fp) == Z_OK && summary->n_reads == sp->n_reads;
+}
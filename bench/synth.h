@@ -0,0 +1,47 @@
+//
+// Reproducible synthetic read datasets for the stew benchmarks.
+//
+
+#ifndef STEW_SYNTH_H
+#define STEW_SYNTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct synth_params_s {
+    uint64_t seed;
+    size_t genome_len;  // reads are sampled from one random genome
+    size_t n_reads;
+    size_t read_len;    // mean read length
+    int long_reads;     // lengths spread over read_len/2..3*read_len/2
+    double dup_rate;    // fraction of reads that exactly repeat an earlier read
+    double error_rate;  // per-base substitution rate of non-duplicate reads
+} synth_params_t;
+
+typedef struct synth_summary_s {
+    size_t n_reads;
+    size_t n_dups;
+    size_t n_bases;
+    size_t bytes;       // uncompressed FASTQ bytes written
+} synth_summary_t;
+
+// splitmix64, small and good enough to drive the generator
+static inline uint64_t synth_rand(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// fill buf with len random bases
+void synth_random_seq(uint64_t *state, char *buf, size_t len);
+
+// short (150 bp Illumina-like) and long (10 kb ONT/PacBio-like) presets
+void synth_params_short(synth_params_t *sp, size_t n_reads, double dup_rate, uint64_t seed);
+void synth_params_long(synth_params_t *sp, size_t n_reads, double dup_rate, uint64_t seed);
+
+// write the dataset as gzipped FASTQ; returns 0 on I/O or allocation failure
+int synth_write_fastq(const synth_params_t *sp, const char *path, synth_summary_t *summary);
+
+#endif //STEW_SYNTH_H
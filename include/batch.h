@@ -0,0 +1,98 @@
+//
+// Batch record arena for reads.
+//
+// A read_batch_t packs many records (name, comment, seq, qual) into one
+// contiguous arena with a per-record offset table. The arena and tables are
+// reused between batches, so filling a batch costs no allocations once it has
+// grown to its working size, and a whole batch can be handed between the
+// reader, the scoring workers and the writer by pointer.
+//
+
+#ifndef STEW_BATCH_H
+#define STEW_BATCH_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <kseq.h>
+
+#define READ_BATCH_MAX_READS 4096
+#define READ_BATCH_MAX_BYTES (8 << 20)
+
+// offsets into the arena and lengths of each field of one record
+typedef struct read_rec_s {
+    size_t name, comment, seq, qual;
+    size_t name_l, comment_l, seq_l, qual_l;
+} read_rec_t;
+
+typedef struct read_batch_s {
+    char *arena;          // NUL-terminated fields of all records
+    size_t arena_l, arena_m;
+    read_rec_t *recs;     // offset table
+    size_t n, m;          // records in batch / allocated
+    size_t max_reads;     // batch is full at this many records...
+    size_t max_bytes;     // ...or once the arena holds this many bytes
+    const char **seqs;    // per-record pointers, valid after read_batch_seal()
+    const char **quals;
+    size_t *lens;
+    size_t tab_m;
+} read_batch_t;
+
+// create an empty batch; 0 for either limit picks the default
+read_batch_t *read_batch_init(size_t max_reads, size_t max_bytes);
+
+// drop all records, keeping the allocations for the next batch
+void read_batch_clear(read_batch_t *rb);
+
+// copy one record into the arena; returns 0 on allocation failure
+int read_batch_push(read_batch_t *rb, const kstring_t *name, const kstring_t *comment,
+                    const kstring_t *seq, const kstring_t *qual);
+
+// fill the seqs/quals/lens tables once the batch is complete; returns 0 on
+// allocation failure
+int read_batch_seal(read_batch_t *rb);
+
+// write the records flagged in keep (all of them if keep is NULL); returns the
+// number of records written
+size_t read_batch_write(const read_batch_t *rb, const uint8_t *keep, FILE *fp_o);
+
+// write the records whose bit level is set in keep, for keep masks of
+// several selectivity levels
+size_t read_batch_write_level(const read_batch_t *rb, const uint8_t *keep, int level, FILE *fp_o);
+
+void read_batch_destroy(read_batch_t *rb);
+
+static inline bool read_batch_full(const read_batch_t *rb)
+{
+    return rb->n >= rb->max_reads || rb->arena_l >= rb->max_bytes;
+}
+
+static inline const char *read_batch_name(const read_batch_t *rb, size_t i)
+{
+    return rb->arena + rb->recs[i].name;
+}
+
+static inline const char *read_batch_comment(const read_batch_t *rb, size_t i)
+{
+    return rb->arena + rb->recs[i].comment;
+}
+
+static inline const char *read_batch_seq(const read_batch_t *rb, size_t i)
+{
+    return rb->arena + rb->recs[i].seq;
+}
+
+static inline const char *read_batch_qual(const read_batch_t *rb, size_t i)
+{
+    return rb->arena + rb->recs[i].qual;
+}
+
+// same test main() always used: a record is written back as FASTQ only if it
+// had both a quality string and a comment
+static inline bool read_batch_is_fastq(const read_batch_t *rb, size_t i)
+{
+    return rb->recs[i].qual_l && rb->recs[i].comment_l;
+}
+
+#endif //STEW_BATCH_H
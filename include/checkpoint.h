@@ -0,0 +1,66 @@
+//
+// Checkpoints of a selection run.
+//
+// A checkpoint is taken between batches and holds everything needed to
+// pick the run up where it was: the scoring state of the context, where
+// each input's parser stood (uncompressed offset, plus the header
+// character kseq had already consumed), how far each output had been
+// written, and the size and modification time of each input, so that a
+// checkpoint isn't resumed on other or rewritten inputs. Resuming seeks the
+// inputs back, truncates the outputs and restores the context, so the
+// output is the same as an uninterrupted run.
+//
+// Checkpoints are written by a background thread: the main thread only
+// copies the context (stew_ctx_clone()), and the writer encodes and hashes
+// it a block at a time straight into the file, so a checkpoint costs one
+// copy of the context on top of the run. Outputs are synced to disk before
+// the checkpoint that refers to them is renamed into place.
+//
+
+#ifndef STEW_CHECKPOINT_H
+#define STEW_CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stew.h>
+
+#define STEW_CKPT_MAX_INPUTS 2
+#define STEW_CKPT_MAX_OUTPUTS (2 * STEW_MAX_LEVELS) // a pair per level
+
+typedef struct stew_ckpt_pos_s {
+    int n_in, n_out;
+    uint64_t in_off[STEW_CKPT_MAX_INPUTS];  // uncompressed offset of the parser
+    int in_last[STEW_CKPT_MAX_INPUTS];      // kseq last_char at that offset
+    uint64_t in_size[STEW_CKPT_MAX_INPUTS]; // size and modification time (ns) of the
+    uint64_t in_mtime[STEW_CKPT_MAX_INPUTS]; // input file the offset is into
+    uint64_t out_off[STEW_CKPT_MAX_OUTPUTS];
+} stew_ckpt_pos_t;
+
+typedef struct stew_ckpt_s stew_ckpt_t;
+
+// start the writer thread for checkpoints of fname
+stew_ckpt_t *stew_ckpt_start(const char *fname);
+
+// snapshot ctx and pos and queue them for writing; out_fds are synced
+// first. Returns 0 without taking a snapshot if the previous checkpoint is
+// still being written.
+int stew_ckpt_submit(stew_ckpt_t *ck, const stew_ctx_t *ctx, const stew_ckpt_pos_t *pos,
+                     const int *out_fds, int n_out);
+
+// record the size and modification time of fnames[0..pos->n_in - 1] in
+// pos; returns 0 if one can't be stat'ed
+int stew_ckpt_stat_inputs(stew_ckpt_pos_t *pos, const char *const *fnames);
+
+// 1 if fnames are still the inputs the checkpoint in pos was taken on,
+// unchanged since
+int stew_ckpt_same_inputs(const stew_ckpt_pos_t *pos, const char *const *fnames);
+
+// wait for the pending checkpoint and stop the thread; returns 0 if any
+// checkpoint failed to be written
+int stew_ckpt_stop(stew_ckpt_t *ck);
+
+// restore ctx and pos from the checkpoint in fname; returns 0 if it can't
+// be read, is corrupt, or was made with different parameters
+int stew_ckpt_load(const char *fname, stew_ctx_t *ctx, stew_ckpt_pos_t *pos);
+
+#endif //STEW_CHECKPOINT_H
@@ -0,0 +1,56 @@
+//
+// K-mer abundance - a count-min sketch for digital normalization.
+//
+// Counters are 8 or 16 bits and saturate. The sketch is cache-blocked: each
+// k-mer hashes to one 64 byte block and all 4 of its rows sit inside it,
+// so a lookup or an update touches a single cache line. Updates are
+// conservative, only raising the counters that hold the k-mer's minimum,
+// which keeps the overestimate of count-min down.
+//
+
+#ifndef STEW_CMS_H
+#define STEW_CMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <lebytes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STEW_CMS_ROWS 4
+#define STEW_CMS_BLOCK 64       // bytes
+#define STEW_CMS_HEADER 16      // saved before the counters
+
+typedef struct stew_cms_s stew_cms_t;
+
+// sketch of at most bytes (at least one block) of bits wide counters (8
+// or 16); NULL if bits is neither or on allocation failure
+stew_cms_t *stew_cms_create(size_t bytes, int bits);
+
+// largest count a counter holds
+uint32_t stew_cms_max_count(const stew_cms_t *c);
+
+// median count of n k-mers; only the low 32 bits of each hash are used, as
+// by the platters. scratch holds n counts.
+uint32_t stew_cms_median(const stew_cms_t *c, const uint64_t *hashes, size_t n, uint32_t *scratch);
+
+// count n k-mers once more
+void stew_cms_add(stew_cms_t *c, const uint64_t *hashes, size_t n);
+
+// serialized sketch, STEW_CMS_HEADER bytes and then the counters
+size_t stew_cms_state_size(const stew_cms_t *c);
+void stew_cms_write(const stew_cms_t *c, le_writer_t *w);
+// returns 0 if buf doesn't fit the sketch
+int stew_cms_load(stew_cms_t *c, const uint8_t *buf);
+// copy src into dst, made with the same size and width
+void stew_cms_copy(stew_cms_t *dst, const stew_cms_t *src);
+
+void stew_cms_destroy(stew_cms_t *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //STEW_CMS_H
@@ -0,0 +1,61 @@
+//
+// Duplicate reads - a cuckoo filter of whole-read fingerprints.
+//
+// An exact copy of a read already seen can't raise a register, so it is
+// caught before its k-mers are hashed. Each read (or pair) is hashed whole,
+// and the hash is looked up and added in a table of 4-way buckets of 32 bit
+// fingerprints, each of which can sit in one of two buckets. The table is
+// sized once from a memory budget. False positives, a new read taken for a
+// copy, happen about once per 500M reads at full load. When no room is left
+// the table only answers lookups, and reads not in it are treated as new.
+//
+
+#ifndef STEW_DEDUP_H
+#define STEW_DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <lebytes.h>
+#include <city.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STEW_DEDUP_SLOTS 4      // fingerprints per bucket
+#define STEW_DEDUP_HEADER 24    // saved before the slots
+
+typedef struct stew_dedup_s stew_dedup_t;
+
+// table of at most bytes (at least one bucket); NULL on allocation failure
+stew_dedup_t *stew_dedup_create(size_t bytes);
+
+// 1 if h was added before; adds it otherwise, if there is room
+int stew_dedup_test_add(stew_dedup_t *d, uint64_t h);
+
+// fingerprints held, and whether some couldn't be added
+uint64_t stew_dedup_count(const stew_dedup_t *d);
+int stew_dedup_full(const stew_dedup_t *d);
+
+// serialized table, STEW_DEDUP_HEADER bytes and then the slots
+size_t stew_dedup_state_size(const stew_dedup_t *d);
+void stew_dedup_write(const stew_dedup_t *d, le_writer_t *w);
+// returns 0 if buf doesn't fit the table
+int stew_dedup_load(stew_dedup_t *d, const uint8_t *buf);
+// copy src into dst, made with the same size
+void stew_dedup_copy(stew_dedup_t *dst, const stew_dedup_t *src);
+
+void stew_dedup_destroy(stew_dedup_t *d);
+
+// hash of a read, or of a pair when seq2 isn't NULL
+static inline uint64_t stew_dedup_hash(const char *seq, size_t len, const char *seq2, size_t len2)
+{
+    uint64_t h = CityHash64(seq, len);
+    return seq2 ? CityHash64WithSeed(seq2, len2, h) : h;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //STEW_DEDUP_H
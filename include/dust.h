@@ -0,0 +1,34 @@
+//
+// Read complexity - DUST scores of reads, to turn away low-complexity reads
+// (homopolymers, short tandem repeats, adapter dimers) before any k-mer of
+// theirs is hashed.
+//
+// The score of a window of 64 bases is the number of pairs of identical
+// triplets in it over the number of triplets less one, as in DUST. A read
+// scores the mean over every window it holds, each found in O(1) from the
+// last by sliding a triplet histogram, or its single window if shorter.
+// Random sequence scores about 0.5, trinucleotide repeats about 10,
+// dinucleotide repeats about 15 and homopolymers 31. Bases other than ACGT
+// count as A, so runs of N score as homopolymers.
+//
+
+#ifndef STEW_DUST_H
+#define STEW_DUST_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STEW_DUST_WINDOW 64 // bases
+#define STEW_DUST_MAX 31    // score of a homopolymer
+
+// DUST score of a read, 0 if shorter than two triplets
+float stew_dust_score(const char *seq, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //STEW_DUST_H
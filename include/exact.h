@@ -0,0 +1,63 @@
+//
+// Exact k-mer sets - the k-mers each platter has seen, counted exactly.
+//
+// K-mers of up to 31 bases are 2-bit packed into 64 bits and mixed with
+// stew_fmix64(), a bijection, so keys are still exact but evenly spread.
+// They are kept in one open-addressing table per platter, split into
+// STEW_EXACT_SHARDS regions by the top 8 bits of the key, which the slots
+// then don't need to hold. A key is only ever probed for inside its region,
+// so threads that own disjoint shards insert into the same table without
+// locks or atomics. Keys are inserted in read order within a shard, so
+// which occurrence of a k-mer finds it new doesn't depend on the thread
+// count. The table is sized once from a memory budget; keys that find their
+// region full are not added and don't count as new.
+//
+
+#ifndef STEW_EXACT_H
+#define STEW_EXACT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <lebytes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STEW_EXACT_MAX_KMER 31
+#define STEW_EXACT_SHARDS 256
+#define STEW_EXACT_HEADER 16    // saved before the slots
+
+typedef struct stew_exact_s stew_exact_t;
+
+// sets for platters platters in at most bytes (at least 16 slots a shard);
+// NULL on allocation failure
+stew_exact_t *stew_exact_create(size_t bytes, int platters);
+
+// add the n keys of shards s with s % parts == part, keys[j] to platter
+// plats[j]; fresh[j] is set to 1 if keys[j] wasn't in the set and was
+// added, 2 if it wasn't and there was no room to add it, and left alone
+// otherwise. fresh is written to for new keys only, so calling this once
+// for every part, on fresh cleared beforehand, covers it all.
+void stew_exact_insert(stew_exact_t *ex, const uint64_t *keys, const uint8_t *plats, size_t n,
+                       int part, int parts, uint8_t *fresh);
+
+// distinct k-mers a platter holds, and whether some couldn't be added
+uint64_t stew_exact_count(const stew_exact_t *ex, int platter);
+int stew_exact_full(const stew_exact_t *ex);
+
+// serialized sets, STEW_EXACT_HEADER bytes and then the slots
+size_t stew_exact_state_size(const stew_exact_t *ex);
+void stew_exact_write(const stew_exact_t *ex, le_writer_t *w);
+// returns 0 if buf doesn't fit the sets
+int stew_exact_load(stew_exact_t *ex, const uint8_t *buf);
+// copy src into dst, made with the same size and platters
+void stew_exact_copy(stew_exact_t *dst, const stew_exact_t *src);
+
+void stew_exact_destroy(stew_exact_t *ex);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //STEW_EXACT_H
@@ -94,9 +94,44 @@ void hll_release(hll_t *hll);
  */
 void hll_add(const hll_t *hll, const char *data, size_t data_len);
 
+/** Add a sample whose hash was already computed
+ *
+ * Lets callers hash samples ahead of time (e.g. on several threads) and only
+ * update the registers serially. The hash must come from the estimator's hash
+ * function for results to match hll_add().
+ *
+ * @param hll - HLL data type
+ * @param hash - Hash of the sample
+ * @return Number of ranks the sample raised its bucket by, 0 if the bucket was unchanged
+ */
+uint8_t hll_add_hash(const hll_t *hll, uint64_t hash);
+
+/** Add a sample whose hash was already computed, reporting the bucket's rank
+ *
+ * Same as hll_add_hash(), for callers that track the registers themselves.
+ *
+ * @param hll - HLL data type
+ * @param hash - Hash of the sample
+ * @param prev - Set to the rank of the sample's bucket before the sample
+ * @return Number of ranks the sample raised its bucket by, 0 if the bucket was unchanged
+ */
+uint8_t hll_add_hash_rank(const hll_t *hll, uint64_t hash, uint8_t *prev);
+
+/** Access the registers of the estimator
+ *
+ * Lets callers save, load or combine estimators without going through
+ * samples. Registers can be written as long as every value stays a valid
+ * rank (at most 33 - bucket_bits).
+ *
+ * @param hll - HLL data type
+ * @param n_buckets - Set to the number of registers if not NULL
+ * @return The registers, 0 on NULL input
+ */
+uint8_t *hll_buckets(const hll_t *hll, size_t *n_buckets);
+
 /** Merge data from two HLLs
  *
- * Data from hll2 will be merged into hll2
+ * Data from hll2 will be merged into hll1
  *
  * @param hll1 - First HLL data type
  * @param hll2 - Second HLL data type
@@ -104,6 +139,17 @@ void hll_add(const hll_t *hll, const char *data, size_t data_len);
  */
 int hll_merge(const hll_t *hll1, const hll_t *hll2);
 
+/** Merge raw register arrays, as saved from hll_buckets()
+ *
+ * Every register of dst is set to the max of itself and the same register
+ * of src. Vectorized where the target allows.
+ *
+ * @param dst - Registers merged into
+ * @param src - Registers merged from
+ * @param n_buckets - Number of registers in each array
+ */
+void hll_merge_buckets(uint8_t *dst, const uint8_t *src, size_t n_buckets);
+
 /* Change the hash function to be used by the estimator
  *
  * @param hll - HLL data type
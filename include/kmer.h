@@ -0,0 +1,207 @@
+//
+// K-mer hashing - the hashes a read's k-mers are added to the platters with.
+//
+// Forward mode hashes each k-mer's bytes with CityHash64. Canonical mode
+// treats a k-mer and its reverse complement as the same k-mer: it hashes
+// both strands with ntHash, which rolls from one k-mer to the next in O(1)
+// per base without building the reverse complement, keeps the smaller of
+// the two and mixes it so the low bits the registers use are well spread.
+// Bases other than ACGT (any case) all hash alike and complement to
+// themselves.
+//
+// Reads can also be subsampled to a representative set of k-mers, chosen
+// from their position in the read alone so that the same stretch of
+// sequence picks the same k-mers wherever it turns up:
+//   minimizers - the k-mer of least ntHash in every window of w k-mers
+//   syncmers   - open syncmers: k-mers whose least s-mer is the middle one
+// Both are found in one streaming pass with a monotone deque over the
+// rolling hashes, and only the k-mers picked are hashed for the platters.
+//
+// K-mers holding a base other than ACGT, or a base of low quality, can be
+// masked out as well: a vectorized pass marks the valid bases of a read in
+// a bitmap, and the pickers skip whole invalid stretches at a time.
+//
+
+#ifndef STEW_KMER_H
+#define STEW_KMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <city.h>
+#include <stew.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ntHash seeds of each base and of its complement
+extern const uint64_t stew_nt_seed[256];
+extern const uint64_t stew_nt_comp_seed[256];
+
+enum {
+    STEW_KMERS_CITY,        // CityHash64 of the forward k-mer
+    STEW_KMERS_NT,          // ntHash of the forward k-mer, unmixed; rolls the
+                            // reverse one along in rh too
+    STEW_KMERS_NT_CANONICAL // ntHash of the smaller strand
+};
+
+// how reads are subsampled
+enum {
+    STEW_SAMPLE_ALL,
+    STEW_SAMPLE_MINIMIZER,  // argument: window in k-mers
+    STEW_SAMPLE_SYNCMER     // argument: s-mer length
+};
+
+#define STEW_SAMPLE_MAX_ARG 255
+
+static inline int stew_sample_valid(int sample, int arg, int k)
+{
+    return sample == STEW_SAMPLE_ALL ||
+           (sample == STEW_SAMPLE_MINIMIZER && arg >= 1 && arg <= STEW_SAMPLE_MAX_ARG) ||
+           (sample == STEW_SAMPLE_SYNCMER && arg >= 1 && arg <= k);
+}
+
+// k-mers per platter a read whose k-mers were filtered is scored as having,
+// 0 if none were left
+static inline size_t stew_sample_nk(size_t picked, int p)
+{
+    return picked >= (size_t)p ? picked / p : picked > 0;
+}
+
+// consecutive k-mers of a read, starting at the first
+typedef struct stew_kmers_s {
+    const char *seq;
+    int k, mode;
+    size_t pos;             // next k-mer to hash
+    uint64_t fh, rh;        // ntHash of the last k-mer, forward and reverse
+} stew_kmers_t;
+
+static inline uint64_t stew_rol(uint64_t v, unsigned s)
+{
+    s &= 63;
+    return s ? (v << s) | (v >> (64 - s)) : v;
+}
+
+static inline uint64_t stew_ror(uint64_t v, unsigned s)
+{
+    s &= 63;
+    return s ? (v >> s) | (v << (64 - s)) : v;
+}
+
+// murmur3's 64 bit finalizer
+static inline uint64_t stew_fmix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// the hash k-mers go to the platters with
+static inline int stew_kmers_mode(int canonical)
+{
+    return canonical ? STEW_KMERS_NT_CANONICAL : STEW_KMERS_CITY;
+}
+
+static inline void stew_kmers_init(stew_kmers_t *it, const char *seq, int k, int mode)
+{
+    it->seq = seq;
+    it->k = k;
+    it->mode = mode;
+    it->pos = 0;
+    it->fh = it->rh = 0;
+}
+
+// hash of the next k-mer; the read must hold at least one more
+static inline uint64_t stew_kmers_next(stew_kmers_t *it)
+{
+    const unsigned char *s = (const unsigned char *)it->seq;
+    int k = it->k;
+    if (it->mode == STEW_KMERS_CITY)
+    {
+        return CityHash64(it->seq + it->pos++, k);
+    }
+    if (!it->pos)
+    {
+        for (int i = 0; i < k; i++)
+        {
+            it->fh ^= stew_rol(stew_nt_seed[s[i]], k - 1 - i);
+            it->rh ^= stew_rol(stew_nt_comp_seed[s[i]], i);
+        }
+    }
+    else
+    {
+        unsigned char out = s[it->pos - 1], in = s[it->pos + k - 1];
+        it->fh = stew_rol(it->fh, 1) ^ stew_rol(stew_nt_seed[out], k) ^ stew_nt_seed[in];
+        it->rh = stew_ror(it->rh, 1) ^ stew_ror(stew_nt_comp_seed[out], 1) ^
+                 stew_rol(stew_nt_comp_seed[in], k - 1);
+    }
+    it->pos++;
+    if (it->mode == STEW_KMERS_NT)
+    {
+        return it->fh;
+    }
+    return stew_fmix64(it->fh < it->rh ? it->fh : it->rh);
+}
+
+#define STEW_MAX_QUAL 93    // phred, as printable in FASTQ
+
+// true if params skip some k-mers, through subsampling or masking
+static inline int stew_kmers_filtered(const stew_params_t *params)
+{
+    return params->sample || params->mask_n || params->min_qual;
+}
+
+// true if the hashes of params carry their platter in the top 32 bits, as
+// those of filtered k-mers and those routed by hash do
+static inline int stew_kmers_routed(const stew_params_t *params)
+{
+    return stew_kmers_filtered(params) || params->route == STEW_ROUTE_HASH;
+}
+
+// k-mers of a read past which it is long: its hashing and its platter
+// updates are split across threads, and threads take fewer reads at a time
+#define STEW_LONG_KMERS 16384
+
+// hash k-mers a to b - 1 of a read of nk k-mers per platter into out[a] to
+// out[b - 1], as stew_kmers_next() does from the first; with hash routing
+// each goes with its platter in the top 32 bits. Ranges of a read can be
+// hashed independently, on different threads.
+void stew_kmers_hash_range(const stew_params_t *params, const char *seq, size_t nk, size_t a,
+                           size_t b, uint64_t *out);
+
+// words of scratch stew_kmers_pick() needs for nk k-mers per platter
+static inline size_t stew_kmers_scratch(const stew_params_t *params, size_t nk)
+{
+    return (nk * params->platters + params->kmer - 1 + 63) / 64;
+}
+
+// set bit i of valid (len / 64 words, rounded up) if base i is ACGT (any
+// case), or anything when mask_n is 0, and its quality is at least min_qual
+// (phred + 33); qual may be NULL
+void stew_kmers_mask(const char *seq, const char *qual, size_t len, int mask_n, int min_qual,
+                     uint64_t *valid);
+
+// the k-mers of seq that params keep, out of the first nk * p, which are
+// routed nk to a platter by position, or by hash. Their hashes go to out,
+// each with its platter in the top 32 bits (the registers only use the low
+// 32); scratch holds stew_kmers_scratch() words. qual may be NULL. Returns
+// how many were picked, at most nk * p.
+size_t stew_kmers_pick(const stew_params_t *params, const char *seq, const char *qual, size_t nk,
+                       uint64_t *scratch, uint64_t *out);
+
+// the k-mers of seq made of ACGT only (and of bases of at least min_qual),
+// out of the first nk * p, 2-bit packed (A 0, C 1, G 2, T 3, first base
+// highest) into out, the smaller strand when canonical; their platters go
+// to plats. k is at most 31 (exact.h). scratch holds stew_kmers_scratch()
+// words, qual may be NULL. Returns how many were packed.
+size_t stew_kmers_pack(const stew_params_t *params, const char *seq, const char *qual, size_t nk,
+                       uint64_t *scratch, uint64_t *out, uint8_t *plats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //STEW_KMER_H
@@ -168,7 +168,7 @@ typedef struct __kstring_t {
    -2   truncated quality string
  */
 #define __KSEQ_READ														\
-	static int kseq_read(kseq_t *seq)									\
+	static long kseq_read(kseq_t *seq)									\
 	{																	\
 		int c;															\
 		kstream_t *ks = seq->f;											\
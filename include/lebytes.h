@@ -0,0 +1,160 @@
+//
+// Little endian encoding of the fixed width fields in stew's binary files
+// (sketches, checkpoints), so they read back the same on any host.
+//
+
+#ifndef STEW_LEBYTES_H
+#define STEW_LEBYTES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+static inline void le_put_u32(uint8_t *b, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) b[i] = (uint8_t)(v >> (8 * i));
+}
+
+static inline void le_put_u64(uint8_t *b, uint64_t v)
+{
+    for (int i = 0; i < 8; i++) b[i] = (uint8_t)(v >> (8 * i));
+}
+
+static inline uint32_t le_get_u32(const uint8_t *b)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) v |= (uint32_t)b[i] << (8 * i);
+    return v;
+}
+
+static inline uint64_t le_get_u64(const uint8_t *b)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)b[i] << (8 * i);
+    return v;
+}
+
+// floats travel as their IEEE 754 bits
+static inline void le_put_f32(uint8_t *b, float f)
+{
+    uint32_t v;
+    memcpy(&v, &f, sizeof(v));
+    le_put_u32(b, v);
+}
+
+static inline float le_get_f32(const uint8_t *b)
+{
+    uint32_t v = le_get_u32(b);
+    float f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+static inline void le_put_f64(uint8_t *b, double f)
+{
+    uint64_t v;
+    memcpy(&v, &f, sizeof(v));
+    le_put_u64(b, v);
+}
+
+static inline double le_get_f64(const uint8_t *b)
+{
+    uint64_t v = le_get_u64(b);
+    double f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+// Large states are encoded through a writer rather than into one buffer:
+// fields are packed into a block of cap bytes, and each full block is handed
+// to sink (the last one, shorter, on le_flush()), so nothing the size of the
+// whole state needs to be held at once. With no sink, buf must hold
+// everything written.
+typedef int (*le_sink_fn)(void *arg, const uint8_t *b, size_t len);
+
+typedef struct le_writer_s {
+    le_sink_fn sink;
+    void *arg;
+    uint8_t *buf;
+    size_t cap, n;
+    int ok;             // 0 once the sink failed
+} le_writer_t;
+
+// hand the block over, returns w->ok
+static inline int le_flush(le_writer_t *w)
+{
+    if (w->sink && w->n)
+    {
+        w->ok = w->ok && w->sink(w->arg, w->buf, w->n);
+        w->n = 0;
+    }
+    return w->ok;
+}
+
+static inline void le_write(le_writer_t *w, const void *src, size_t len)
+{
+    const uint8_t *s = (const uint8_t *)src;
+    while (len)
+    {
+        if (w->n == w->cap) le_flush(w);
+        size_t l = w->cap - w->n < len ? w->cap - w->n : len;
+        memcpy(w->buf + w->n, s, l);
+        w->n += l;
+        s += l;
+        len -= l;
+    }
+}
+
+static inline void le_write_u32(le_writer_t *w, uint32_t v)
+{
+    if (w->cap - w->n >= 4) // fits the block
+    {
+        le_put_u32(w->buf + w->n, v);
+        w->n += 4;
+        return;
+    }
+    uint8_t b[4];
+    le_put_u32(b, v);
+    le_write(w, b, 4);
+}
+
+static inline void le_write_u64(le_writer_t *w, uint64_t v)
+{
+    if (w->cap - w->n >= 8) // fits the block
+    {
+        le_put_u64(w->buf + w->n, v);
+        w->n += 8;
+        return;
+    }
+    uint8_t b[8];
+    le_put_u64(b, v);
+    le_write(w, b, 8);
+}
+
+static inline void le_write_f32(le_writer_t *w, float f)
+{
+    if (w->cap - w->n >= 4) // fits the block
+    {
+        le_put_f32(w->buf + w->n, f);
+        w->n += 4;
+        return;
+    }
+    uint8_t b[4];
+    le_put_f32(b, f);
+    le_write(w, b, 4);
+}
+
+static inline void le_write_f64(le_writer_t *w, double f)
+{
+    if (w->cap - w->n >= 8) // fits the block
+    {
+        le_put_f64(w->buf + w->n, f);
+        w->n += 8;
+        return;
+    }
+    uint8_t b[8];
+    le_put_f64(b, f);
+    le_write(w, b, 8);
+}
+
+#endif //STEW_LEBYTES_H
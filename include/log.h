@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
 #define LOG_VERSION "0.1.0"
@@ -30,12 +31,20 @@ typedef void (*log_LockFn)(bool lock, void *udata);
 
 enum { LOG_TRACE, LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_FATAL };
 
-#define log_trace(...) log_log(LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
-#define log_debug(...) log_log(LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define log_info(...)  log_log(LOG_INFO,  __FILE__, __LINE__, __VA_ARGS__)
-#define log_warn(...)  log_log(LOG_WARN,  __FILE__, __LINE__, __VA_ARGS__)
-#define log_error(...) log_log(LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define log_fatal(...) log_log(LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__)
+/* Lowest level any output would take. The macros test it before calling
+ * log_log(), so a disabled level costs one compare and its arguments are
+ * never evaluated. */
+extern int log_threshold;
+
+#define log_at(level, ...) \
+    ((level) >= log_threshold ? log_log((level), __FILE__, __LINE__, __VA_ARGS__) : (void)0)
+
+#define log_trace(...) log_at(LOG_TRACE, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...)  log_at(LOG_INFO,  __VA_ARGS__)
+#define log_warn(...)  log_at(LOG_WARN,  __VA_ARGS__)
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+#define log_fatal(...) log_at(LOG_FATAL, __VA_ARGS__)
 
 const char* log_level_string(int level);
 void log_set_lock(log_LockFn fn, void *udata);
@@ -44,6 +53,17 @@ void log_set_quiet(bool enable);
 int log_add_callback(log_LogFn fn, void *udata, int level);
 int log_add_fp(FILE *fp, int level);
 
+/* Hand events to a background thread through a bounded ring of at least
+ * capacity slots instead of writing them on the calling thread. Callers
+ * only format their message and never block on I/O or the user lock;
+ * outputs are flushed once the queue is drained rather than per event.
+ * When the ring is full, events below LOG_WARN are dropped (and counted),
+ * warnings and errors wait for room. */
+int log_start_async(size_t capacity);
+/* drain the queue and go back to logging on the calling thread */
+void log_stop_async(void);
+uint64_t log_dropped(void);
+
 void log_log(int level, const char *file, int line, const char *fmt, ...);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,72 @@
+//
+// Near-duplicate reads - MinHash signatures of reads and an LSH index of the
+// signatures of the reads selected.
+//
+// A signature is a one-permutation MinHash of the k-mer hashes a read is
+// scored on: the k-mers are spread over 16 bins by hash and each bin keeps
+// the least, with empty bins filled from the next full one. The fraction of
+// bins two signatures agree on estimates the Jaccard similarity of their
+// k-mer sets. Signatures are banded 4 bins at a time into 4 tables, so a
+// read shares a band with one of Jaccard J with probability 1 - (1 - J^4)^4
+// (0.89 at 0.8, 0.23 at 0.5), and only reads sharing a band are compared.
+//
+// Memory is bounded by a cap on the signatures retained: they are kept in a
+// ring, the oldest overwritten first, and the band tables are direct-mapped,
+// a band overwriting whatever sat in its place. Lookups compare against the
+// signature a band points to now, so stale entries cost nothing but a miss.
+//
+
+#ifndef STEW_MINHASH_H
+#define STEW_MINHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <lebytes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STEW_MINHASH_BINS 16
+#define STEW_MINHASH_BANDS 4
+#define STEW_MINHASH_ROWS (STEW_MINHASH_BINS / STEW_MINHASH_BANDS)
+#define STEW_LSH_HEADER 16      // saved before the signatures
+
+typedef struct stew_minhash_s {
+    uint32_t bin[STEW_MINHASH_BINS];
+} stew_minhash_t;
+
+// signature of a read from the hashes of its k-mers; only the low 32 bits
+// of each hash are used, as by the platters
+void stew_minhash_sign(const uint64_t *hashes, size_t n, stew_minhash_t *sig);
+
+// estimated Jaccard similarity of two signatures
+float stew_minhash_similarity(const stew_minhash_t *a, const stew_minhash_t *b);
+
+typedef struct stew_lsh_s stew_lsh_t;
+
+// index retaining up to max_sigs signatures; NULL on allocation failure
+stew_lsh_t *stew_lsh_create(size_t max_sigs);
+
+// 1 if a signature retained shares a band with sig and is at least jaccard
+// similar to it
+int stew_lsh_query(const stew_lsh_t *l, const stew_minhash_t *sig, float jaccard);
+
+// retain sig, overwriting the oldest signature once full
+void stew_lsh_add(stew_lsh_t *l, const stew_minhash_t *sig);
+
+// serialized index, STEW_LSH_HEADER bytes, the signatures and the bands
+size_t stew_lsh_state_size(const stew_lsh_t *l);
+void stew_lsh_write(const stew_lsh_t *l, le_writer_t *w);
+// returns 0 if buf doesn't fit the index
+int stew_lsh_load(stew_lsh_t *l, const uint8_t *buf);
+// copy src into dst, made with the same max_sigs
+void stew_lsh_copy(stew_lsh_t *dst, const stew_lsh_t *src);
+
+void stew_lsh_destroy(stew_lsh_t *l);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //STEW_MINHASH_H
@@ -0,0 +1,29 @@
+//
+// Live progress and throughput reporting.
+//
+// A timer thread samples the run's counters, logs reads processed, reads
+// selected, the current selection rate, reads/s and input MB/s, and can
+// rewrite a metrics snapshot (Prometheus textfile or JSON) for a node
+// exporter to scrape. Nothing here runs on the scoring path: the counters
+// are read with relaxed atomic loads.
+//
+
+#ifndef STEW_PROGRESS_H
+#define STEW_PROGRESS_H
+
+#include <stats.h>
+
+typedef struct stew_progress_s stew_progress_t;
+
+// start reporting on st; interval_s is the period of the progress log line
+// (0 for none), metrics_file is rewritten every metrics_interval_s seconds
+// (NULL for none). A file ending in .json gets JSON, anything else the
+// Prometheus text format. Returns NULL if there is nothing to report or the
+// thread couldn't be started.
+stew_progress_t *stew_progress_start(const stew_stats_t *st, int interval_s,
+                                     const char *metrics_file, int metrics_interval_s);
+
+// stop the timer thread, writing one last snapshot
+void stew_progress_stop(stew_progress_t *pg);
+
+#endif //STEW_PROGRESS_H
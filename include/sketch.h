@@ -0,0 +1,161 @@
+//
+// Stew sketches - HLL platters saved to disk.
+//
+// A sketch holds the platter registers of a dataset together with what is
+// needed to interpret them: the hash function, k, the number of platters
+// and cups, and how k-mers were routed to platters. The file is a 64 byte
+// header of little endian fields followed by one register array per
+// platter, each starting on a 64 byte boundary, so a sketch can be mapped
+// and used in place on any host.
+//
+//   offset  size  field
+//        0     8  magic "STEWSKCH"
+//        8     4  version
+//       12     4  header size (64)
+//       16     4  hash id
+//       20     4  k
+//       24     4  platters
+//       28     4  cups (log2 of the registers per platter)
+//       32     4  flags
+//       36     4  max k-mers per platter of any read, saturating
+//       40     8  reads sketched
+//       48     8  k-mers sketched
+//       56     8  platter stride in bytes
+//
+// The registers are those a stew run over the same reads with the same k,
+// p and cups ends up with: k-mer s of a read of n k-mers per platter goes
+// to platter s / n, or with hash routing to the platter its hash picks,
+// and all reads are sketched whether selected or not. With subsampling or
+// masking, only the k-mers picked go in, routed the same way, and max
+// k-mers counts those picked.
+//
+
+#ifndef STEW_SKETCH_H
+#define STEW_SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stew.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STEW_SKETCH_MAGIC "STEWSKCH"
+#define STEW_SKETCH_VERSION 1
+#define STEW_SKETCH_HEADER 64
+#define STEW_SKETCH_ALIGN 64
+
+#define STEW_SKETCH_HASH_CITY64 1   // low 32 bits of CityHash64 of the k-mer
+#define STEW_SKETCH_HASH_NT_CANON 2 // canonical ntHash of the k-mer, see kmer.h
+#define STEW_SKETCH_ROUTE_POS 0x1   // k-mers routed to platters by position
+#define STEW_SKETCH_MASK_N 0x2      // k-mers with bases other than ACGT skipped
+#define STEW_SKETCH_ROUTE_HASH 0x4  // k-mers routed to platters by hash
+// flags bits 8-15: k-mer subsampling (STEW_SAMPLE_*), 16-23: its argument,
+// 24-31: least base quality of the k-mers sketched
+
+typedef struct stew_sketch_s {
+    uint32_t version, hash_id, kmer, platters, cups, flags, max_nk;
+    uint64_t n_reads, n_kmers;
+    size_t stride;          // bytes between platters, a multiple of 64
+    uint8_t *regs;          // platter i starts at regs + i * stride
+    void *mem;              // mapping or allocation backing the registers
+    size_t mem_l;
+    int mapped;
+} stew_sketch_t;
+
+// empty in-memory sketch
+stew_sketch_t *stew_sketch_create(int kmer, int platters, int cups);
+
+// map a sketch file; the mapping is private, so registers may be changed
+// without touching the file. NULL if it can't be read or isn't valid.
+stew_sketch_t *stew_sketch_open(const char *fname);
+
+// write the sketch to fname, returns 0 on error
+int stew_sketch_save(const stew_sketch_t *sk, const char *fname);
+
+void stew_sketch_close(stew_sketch_t *sk);
+
+// hash id of the k-mer hashes made with params
+static inline uint32_t stew_sketch_hash_id(const stew_params_t *params)
+{
+    return params->canonical ? STEW_SKETCH_HASH_NT_CANON : STEW_SKETCH_HASH_CITY64;
+}
+
+// flags of the sketches made with params
+static inline uint32_t stew_sketch_flags(const stew_params_t *params)
+{
+    return (params->route == STEW_ROUTE_HASH ? STEW_SKETCH_ROUTE_HASH : STEW_SKETCH_ROUTE_POS) |
+           (params->mask_n ? STEW_SKETCH_MASK_N : 0) |
+           (uint32_t)params->sample << 8 | (uint32_t)params->sample_arg << 16 |
+           (uint32_t)params->min_qual << 24;
+}
+
+static inline uint8_t *stew_sketch_platter(const stew_sketch_t *sk, int i)
+{
+    return sk->regs + (size_t)i * sk->stride;
+}
+
+// snapshot of the platters of a selection context
+stew_sketch_t *stew_ctx_sketch(const stew_ctx_t *ctx);
+
+// measure novelty against sk as well: every platter of ctx gets the union
+// of all of its platters, since a k-mer seen before may be routed to any
+// platter in a new read. Routed by hash, a k-mer always goes to the same
+// platter, so platters are merged platter by platter instead, and the
+// sketch needs as many. Needs the same hash, k, cups and routing, and an
+// engine with platters (hll or delta); returns 0 otherwise. Call before
+// scoring.
+int stew_ctx_preload(stew_ctx_t *ctx, const stew_sketch_t *sk);
+
+// pick up where the reads sketched in sk left off, as though they had just
+// been scored by ctx: platters are merged platter by platter, and the
+// longest read and the read count carry over. The running averages can't be
+// recovered from a sketch and start from scratch. Needs a compatible sketch
+// (same hash, k, platters and cups) and an engine with platters, returns 0
+// otherwise.
+int stew_ctx_warm_start(stew_ctx_t *ctx, const stew_sketch_t *sk);
+
+// calibrate scoring to a sketch of the whole input (same hash, k, platters
+// and cups, and an engine with platters, returns 0 otherwise), taken in a
+// first pass. The platters will end up holding what they hold now plus sk,
+// so each new k-mer is weighed by how little of its platter is still left to
+// fill, and reads are corrected against the longest read of the input from
+// the start rather than the longest seen so far. Call before scoring, after
+// any preload or warm start.
+int stew_ctx_calibrate(stew_ctx_t *ctx, const stew_sketch_t *sk);
+
+// merge src into dst platter by platter, so that dst sketches the reads of
+// both; returns 0 unless both were made with the same hash, k, platters,
+// cups and routing
+int stew_sketch_merge(stew_sketch_t *dst, const stew_sketch_t *src);
+
+// true if sk can be used with these engine parameters
+int stew_sketch_compatible(const stew_sketch_t *sk, const stew_params_t *params);
+
+// builds a sketch from reads as fast as possible: reads are independent
+// here, so each thread keeps its own platters and they are merged at the end
+typedef struct stew_sketcher_s stew_sketcher_t;
+
+stew_sketcher_t *stew_sketcher_create(const stew_params_t *params);
+
+// sketch n reads, returns 0 on allocation failure
+int stew_sketcher_add(stew_sketcher_t *sc, const char *const *seqs, const size_t *lens, size_t n);
+
+// the same with base qualities, which may be NULL, for min_qual
+int stew_sketcher_add_qual(stew_sketcher_t *sc, const char *const *seqs, const char *const *quals,
+                           const size_t *lens, size_t n);
+
+// merge the per thread platters into a new sketch
+stew_sketch_t *stew_sketcher_finish(stew_sketcher_t *sc);
+
+// reads and k-mers sketched so far; the stats report of the sketcher
+stew_stats_t *stew_sketcher_stats(stew_sketcher_t *sc);
+
+void stew_sketcher_destroy(stew_sketcher_t *sc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //STEW_SKETCH_H
@@ -0,0 +1,71 @@
+//
+// Per-stage timings and counters of a stew run.
+//
+// Counters are always kept; stage timings are only taken when asked for,
+// since they cost a clock read at every stage boundary.
+//
+
+#ifndef STEW_STATS_H
+#define STEW_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    STEW_STAGE_DECOMPRESS,
+    STEW_STAGE_PARSE,
+    STEW_STAGE_KMERIZE,
+    STEW_STAGE_ESTIMATE,
+    STEW_STAGE_SCORE,
+    STEW_STAGE_WRITE,
+    STEW_STAGE_N
+};
+
+typedef struct stew_stats_s {
+    uint64_t start_ns;
+    uint64_t stage_ns[STEW_STAGE_N];
+    uint64_t reads_in;             // reads (pairs in paired mode) scored
+    uint64_t reads_out;            // reads (pairs) selected
+    uint64_t reads_dusted;         // reads (pairs) rejected as low complexity
+    uint64_t reads_duplicate;      // reads (pairs) skipped as exact duplicates
+    uint64_t reads_near_duplicate; // reads (pairs) not selected for resembling a selected one
+    uint64_t kmers_hashed;
+    uint64_t register_updates;     // k-mers that raised a platter register
+    uint64_t kmers_unstored;       // new k-mers the exact engine's sets had no room for
+    uint64_t bytes_in;             // decompressed input bytes
+    uint64_t bytes_in_compressed;
+    uint64_t bytes_out;
+} stew_stats_t;
+
+static inline uint64_t stew_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// bump a counter that other threads (the progress reporter) may be reading;
+// counters have a single writer, so a relaxed store is enough
+static inline void stew_stats_add(uint64_t *counter, uint64_t v)
+{
+    __atomic_store_n(counter, *counter + v, __ATOMIC_RELAXED);
+}
+
+// zero all counters and start the wall clock
+void stew_stats_init(stew_stats_t *st);
+
+const char *stew_stage_name(int stage);
+
+// write the report as JSON, with wall/CPU time and peak RSS of the process
+int stew_stats_write_json(const stew_stats_t *st, FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //STEW_STATS_H
@@ -0,0 +1,167 @@
+//
+// libstew - streaming read diversity selection.
+//
+// The selection engine behind the stew CLI. A context owns the HLL platters
+// and the running scoring state; reads are fed to it in order, a batch at a
+// time, and it flags which of them add enough diversity to be kept. Results
+// depend on the order reads are fed in, exactly as in a stew run.
+//
+
+#ifndef STEW_H
+#define STEW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stats.h>
+#include <lebytes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STEW_MAX_PLATTERS 50
+#define STEW_MIN_CUPS 4
+#define STEW_MAX_CUPS 16
+#define STEW_MAX_KMER 100
+#define STEW_MAX_LEVELS 8
+
+// scoring engines
+enum {
+    STEW_ENGINE_HLL,    // novelty: growth of the distinct k-mers of the platters
+    STEW_ENGINE_CMS,    // coverage: median k-mer abundance in a count-min sketch (cms.h)
+    STEW_ENGINE_DELTA,  // novelty, counted from the registers each read raises
+    STEW_ENGINE_EXACT   // novelty, counted exactly in sets of the k-mers seen (exact.h)
+};
+
+// how k-mers are routed to platters
+enum {
+    STEW_ROUTE_POS,     // by position: k-mer s of a read of n per platter goes to platter s / n
+    STEW_ROUTE_HASH     // by hash, so a k-mer goes to the same platter in reads of any length
+};
+
+typedef struct stew_params_s {
+    int threads;    // threads used to hash k-mers, and to split long reads across
+    int platters;   // number of platters (arrays) of HLL structures
+    int cups;       // cups (bits) in each HLL platter
+    int kmer;       // k-mer size
+    float select;   // selectivity, 0 (least selective) to 1 (most selective)
+    float momentum; // momentum applied to boost the score
+    int timing;     // time the kmerize/estimate/score stages into the stats
+    int canonical;  // a k-mer and its reverse complement count as one
+    int sample;     // k-mer subsampling, STEW_SAMPLE_* in kmer.h, 0 for all k-mers
+    int sample_arg; // minimizer window in k-mers, or syncmer s-mer length
+    int mask_n;     // skip k-mers holding a base other than ACGT
+    int min_qual;   // skip k-mers holding a base below this phred quality, 0 for none
+    float dust;     // reject reads of a DUST score above this unhashed (dust.h), 0 for none
+    int dedup_mb;   // skip exact duplicates with a table of this many MB (dedup.h), 0 for none
+    float near_dup; // don't select reads at least this similar to a selected one
+                    // (minhash.h), 0 for none; a single level only
+    int near_dup_max; // selected reads remembered for near_dup
+    int engine;     // STEW_ENGINE_*
+    float coverage; // cms: reads score 1 - median k-mer count / coverage
+    int cms_mb;     // cms: size of the sketch in MB
+    int cms_bits;   // cms: counter width, 8 or 16
+    int exact_mb;   // exact: size of the k-mer sets in MB
+    int route;      // STEW_ROUTE_*
+    int levels;     // selectivities scored in the same pass, 1 to STEW_MAX_LEVELS
+    float level_select[STEW_MAX_LEVELS]; // their values when levels > 1,
+                                         // level_select[0] replaces select
+} stew_params_t;
+
+typedef struct stew_ctx_s stew_ctx_t;
+
+// fill params with the stew defaults
+void stew_params_default(stew_params_t *params);
+
+// create a selection context; NULL if params are out of bounds or on
+// allocation failure
+stew_ctx_t *stew_ctx_create(const stew_params_t *params);
+
+// score n reads in order; keep_mask[i] is set to 1 if read i is selected and
+// to 0 otherwise. Returns the number of reads selected, -1 on error.
+// With several levels, bit l of keep_mask[i] is set if read i is selected at
+// level l, and the return value and counters are those of level 0: the
+// platters see every read regardless, so the levels share all the hashing
+// and estimation and only differ in their running averages.
+long stew_score_batch(stew_ctx_t *ctx, const char *const *seqs, const size_t *lens,
+                      size_t n, uint8_t *keep_mask);
+
+// The delta engine scores like hll, but never estimates a platter's
+// cardinality: each register a k-mer raises counts 1 / q new k-mers, q being
+// the chance that a new k-mer raises one (the historic inverse probability
+// estimate), and q is kept up to date as registers rise. A read then costs
+// time in its length only, whatever p and cups.
+//
+// The exact engine keeps the k-mers themselves, in a set per platter, and
+// scores like hll from exact counts of the distinct k-mers in each, which
+// makes it a ground truth for the estimates. It takes k up to 31, k-mers
+// of ACGT only, no subsampling and no near duplicates, and about 9 bytes a
+// distinct k-mer.
+//
+// The cms engine normalizes coverage instead: a read scores 1 - m / coverage,
+// m being the median count of its k-mers among the reads selected so far,
+// so select 0 keeps reads until their k-mers reach coverage. Only the k-mers
+// of selected reads are counted, and a single level is supported.
+
+// stew_score_batch() with the base qualities of the reads (phred + 33), for
+// min_qual; quals, or any quals[i], may be NULL to use every base
+long stew_score_batch_qual(stew_ctx_t *ctx, const char *const *seqs, const char *const *quals,
+                           const size_t *lens, size_t n, uint8_t *keep_mask);
+
+// score n read pairs on their first mates; the second mates only count
+// towards telling duplicate pairs apart
+long stew_score_batch_pairs(stew_ctx_t *ctx, const char *const *seqs, const char *const *quals,
+                            const size_t *lens, const char *const *seqs2, const size_t *lens2,
+                            size_t n, uint8_t *keep_mask);
+
+// Target-size mode: from here on keep about fraction of the reads at level
+// 0, the other levels still compare against their own selectivity. Scores
+// are still computed with select, but are compared against a quantile of
+// the recent scores, taken so that the reads kept catch up with fraction of
+// those passed since target mode began; a negative fraction goes back to
+// comparing against select. May be called between batches as the estimate
+// of the fraction needed changes.
+void stew_ctx_set_target(stew_ctx_t *ctx, double fraction);
+
+// never select more than max reads in total, 0 for no cap
+void stew_ctx_set_max_selected(stew_ctx_t *ctx, uint64_t max);
+
+// the threshold scores are currently compared against
+double stew_ctx_threshold(const stew_ctx_t *ctx);
+
+// reads scored / selected so far
+uint64_t stew_ctx_seen(const stew_ctx_t *ctx);
+uint64_t stew_ctx_selected(const stew_ctx_t *ctx);
+// reads selected so far at a level
+uint64_t stew_ctx_selected_level(const stew_ctx_t *ctx, int level);
+
+// counters and stage timings of the context; the caller may add its own
+// stages (decompression, parsing, writing) to the same report
+stew_stats_t *stew_ctx_stats(stew_ctx_t *ctx);
+
+// Serialized scoring state: the platter registers, the running per-platter
+// counts and averages, the read counters and the parameters it was made
+// with. A context restored from it scores the rest of a stream exactly as
+// the context it was saved from would have.
+size_t stew_ctx_state_size(const stew_ctx_t *ctx);
+// write the state to buf, which holds stew_ctx_state_size() bytes
+void stew_ctx_state_save(const stew_ctx_t *ctx, uint8_t *buf);
+// the same through w, a block at a time (not flushed at the end); returns
+// 0 if its sink failed
+int stew_ctx_state_write(const stew_ctx_t *ctx, le_writer_t *w);
+// restore the state; returns 0 if buf is malformed or was saved with
+// different k, platters, cups, selectivities, momentum, k-mer options or
+// read filters
+int stew_ctx_state_load(stew_ctx_t *ctx, const uint8_t *buf, size_t len);
+// a copy of the scoring state of ctx, which can be saved on another thread
+// while ctx scores on; a plain copy of its tables, so cheaper than
+// stew_ctx_state_save(). NULL on allocation failure.
+stew_ctx_t *stew_ctx_clone(const stew_ctx_t *ctx);
+
+void stew_ctx_destroy(stew_ctx_t *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //STEW_H
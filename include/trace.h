@@ -0,0 +1,49 @@
+//
+// Pipeline tracing in the Chrome trace-event format.
+//
+// When tracing is on, each thread appends complete spans (name, start,
+// duration and one numeric argument, usually the batch number) to a buffer
+// of its own, so recording takes no lock. The spans are dumped as JSON at
+// the end of the run and open in Perfetto or chrome://tracing, where
+// bubbles between stages and imbalance between hashing workers show up
+// directly.
+//
+
+#ifndef STEW_TRACE_H
+#define STEW_TRACE_H
+
+#include <stdint.h>
+#include <stats.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int stew_trace_on;
+
+static inline int stew_trace_enabled(void)
+{
+    return stew_trace_on;
+}
+
+// start recording spans
+void stew_trace_start(void);
+
+// name the calling thread in the trace unless it already has a name
+// (copied, at most 31 characters)
+void stew_trace_thread_name(const char *name);
+
+// record a span of the calling thread from t0 to t1 (stew_now_ns() times);
+// name must outlive the trace, arg_name may be NULL for no argument
+void stew_trace_span(const char *name, uint64_t t0, uint64_t t1,
+                     const char *arg_name, uint64_t arg);
+
+// stop recording and write the spans as trace-event JSON; returns 0 on
+// error. Threads that recorded spans must have finished doing so.
+int stew_trace_write(const char *fname);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //STEW_TRACE_H
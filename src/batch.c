@@ -0,0 +1,155 @@
+//
+// Batch record arena for reads.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <batch.h>
+
+read_batch_t *read_batch_init(size_t max_reads, size_t max_bytes)
+{
+    read_batch_t *rb = (read_batch_t *)calloc(1, sizeof(read_batch_t));
+    if (!rb)
+    {
+        return NULL;
+    }
+    rb->max_reads = max_reads ? max_reads : READ_BATCH_MAX_READS;
+    rb->max_bytes = max_bytes ? max_bytes : READ_BATCH_MAX_BYTES;
+    return rb;
+}
+
+void read_batch_clear(read_batch_t *rb)
+{
+    rb->n = 0;
+    rb->arena_l = 0;
+}
+
+// append one NUL-terminated field to the arena and return its offset
+static size_t arena_put(read_batch_t *rb, const kstring_t *str)
+{
+    size_t off = rb->arena_l;
+    size_t l = str ? str->l : 0;
+    if (l)
+    {
+        memcpy(rb->arena + off, str->s, l);
+    }
+    rb->arena[off + l] = '\0';
+    rb->arena_l += l + 1;
+    return off;
+}
+
+int read_batch_push(read_batch_t *rb, const kstring_t *name, const kstring_t *comment,
+                    const kstring_t *seq, const kstring_t *qual)
+{
+    if (rb->n == rb->m)
+    {
+        size_t m = rb->m ? rb->m << 1 : 256;
+        read_rec_t *recs = (read_rec_t *)realloc(rb->recs, m * sizeof(read_rec_t));
+        if (!recs)
+        {
+            return 0;
+        }
+        rb->recs = recs;
+        rb->m = m;
+    }
+
+    size_t need = rb->arena_l + 4 + (name ? name->l : 0) + (comment ? comment->l : 0) +
+                  (seq ? seq->l : 0) + (qual ? qual->l : 0);
+    if (need > rb->arena_m)
+    {
+        size_t m = rb->arena_m ? rb->arena_m : 1 << 16;
+        while (m < need) m <<= 1;
+        char *arena = (char *)realloc(rb->arena, m);
+        if (!arena)
+        {
+            return 0;
+        }
+        rb->arena = arena;
+        rb->arena_m = m;
+    }
+
+    read_rec_t *r = &rb->recs[rb->n++];
+    r->name_l = name ? name->l : 0;
+    r->comment_l = comment ? comment->l : 0;
+    r->seq_l = seq ? seq->l : 0;
+    r->qual_l = qual ? qual->l : 0;
+    r->name = arena_put(rb, name);
+    r->comment = arena_put(rb, comment);
+    r->seq = arena_put(rb, seq);
+    r->qual = arena_put(rb, qual);
+    return 1;
+}
+
+int read_batch_seal(read_batch_t *rb)
+{
+    if (rb->tab_m < rb->m) // pointer tables follow the offset table
+    {
+        const char **seqs = (const char **)realloc((void *)rb->seqs, rb->m * sizeof(char *));
+        if (!seqs) return 0;
+        rb->seqs = seqs;
+        const char **quals = (const char **)realloc((void *)rb->quals, rb->m * sizeof(char *));
+        if (!quals) return 0;
+        rb->quals = quals;
+        size_t *lens = (size_t *)realloc(rb->lens, rb->m * sizeof(size_t));
+        if (!lens) return 0;
+        rb->lens = lens;
+        rb->tab_m = rb->m;
+    }
+    for (size_t i = 0; i < rb->n; i++)
+    {
+        rb->seqs[i] = read_batch_seq(rb, i);
+        rb->quals[i] = rb->recs[i].qual_l ? read_batch_qual(rb, i) : NULL;
+        rb->lens[i] = rb->recs[i].seq_l;
+    }
+    return 1;
+}
+
+// write one record back out, as FASTQ or FASTA
+static void read_batch_write_one(const read_batch_t *rb, size_t i, FILE *fp_o)
+{
+    if (read_batch_is_fastq(rb, i))
+    {
+        fprintf(fp_o, "@%s %s\n", read_batch_name(rb, i), read_batch_comment(rb, i));
+        fprintf(fp_o, "%s\n", read_batch_seq(rb, i));
+        fprintf(fp_o, "+\n");
+        fprintf(fp_o, "%s\n", read_batch_qual(rb, i));
+    }
+    else
+    {
+        fprintf(fp_o, ">%s\n", read_batch_name(rb, i));
+        fprintf(fp_o, "%s\n", read_batch_seq(rb, i));
+    }
+}
+
+size_t read_batch_write(const read_batch_t *rb, const uint8_t *keep, FILE *fp_o)
+{
+    return read_batch_write_level(rb, keep, 0, fp_o);
+}
+
+size_t read_batch_write_level(const read_batch_t *rb, const uint8_t *keep, int level, FILE *fp_o)
+{
+    size_t written = 0;
+    for (size_t i = 0; i < rb->n; i++)
+    {
+        if (!keep || (keep[i] >> level & 1))
+        {
+            read_batch_write_one(rb, i, fp_o);
+            written++;
+        }
+    }
+    return written;
+}
+
+void read_batch_destroy(read_batch_t *rb)
+{
+    if (!rb)
+    {
+        return;
+    }
+    free(rb->arena);
+    free(rb->recs);
+    free((void *)rb->seqs);
+    free((void *)rb->quals);
+    free(rb->lens);
+    free(rb);
+}
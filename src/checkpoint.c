@@ -0,0 +1,318 @@
+//
+// Checkpoints of a selection run.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <log.h>
+#include <checkpoint.h>
+#include <lebytes.h>
+#include <city.h>
+
+#define STEW_CKPT_MAGIC "STEWCKPT"
+#define STEW_CKPT_VERSION 4
+#define STEW_CKPT_HEADER 224
+#define STEW_CKPT_BLOCK (1 << 20) // written and hashed a block at a time
+
+//   0  magic, version, inputs, outputs
+//  24  per input: uncompressed offset, kseq last_char
+//  56  per output: bytes written
+// 184  size of the context state
+// 192  per input: file size, modification time in ns
+// 224  the context state
+// end  hash of everything before it: CityHash64WithSeed of each block of
+//      STEW_CKPT_BLOCK bytes (the last one shorter), seeded with the hash
+//      of the block before it (0 for the first)
+struct stew_ckpt_s {
+    char *fname, *tmp;
+    stew_ctx_t *snap;       // pending snapshot, NULL when idle
+    stew_ckpt_pos_t pos;    // and where the run stood
+    int fds[STEW_CKPT_MAX_OUTPUTS], n_fds;
+    int busy, stop, failed;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static int ckpt_write_all(int fd, const uint8_t *buf, size_t len)
+{
+    while (len)
+    {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0) return 0;
+        buf += w;
+        len -= w;
+    }
+    return 1;
+}
+
+// the hash of len bytes, chained a block at a time
+static uint64_t ckpt_hash(const uint8_t *buf, size_t len)
+{
+    uint64_t h = 0;
+    for (size_t off = 0; off < len; off += STEW_CKPT_BLOCK)
+    {
+        size_t l = len - off < STEW_CKPT_BLOCK ? len - off : STEW_CKPT_BLOCK;
+        h = CityHash64WithSeed((const char *)buf + off, l, h);
+    }
+    return h;
+}
+
+typedef struct ckpt_sink_s {
+    int fd;
+    uint64_t hash;
+} ckpt_sink_t;
+
+// a block of the checkpoint, written out and hashed
+static int ckpt_sink(void *arg, const uint8_t *b, size_t len)
+{
+    ckpt_sink_t *s = (ckpt_sink_t *)arg;
+    s->hash = CityHash64WithSeed((const char *)b, len, s->hash);
+    return ckpt_write_all(s->fd, b, len);
+}
+
+// encode a snapshot straight to fd, a block at a time, so that no copy of
+// the whole state is ever held
+static int ckpt_encode(int fd, const stew_ctx_t *snap, const stew_ckpt_pos_t *pos)
+{
+    uint8_t *block = (uint8_t *)malloc(STEW_CKPT_BLOCK);
+    if (!block)
+    {
+        return 0;
+    }
+    uint8_t hdr[STEW_CKPT_HEADER] = { 0 };
+    memcpy(hdr, STEW_CKPT_MAGIC, 8);
+    le_put_u32(hdr + 8, STEW_CKPT_VERSION);
+    le_put_u32(hdr + 12, pos->n_in);
+    le_put_u32(hdr + 16, pos->n_out);
+    for (int i = 0; i < pos->n_in; i++)
+    {
+        le_put_u64(hdr + 24 + 16 * i, pos->in_off[i]);
+        le_put_u32(hdr + 32 + 16 * i, (uint32_t)pos->in_last[i]);
+    }
+    for (int i = 0; i < pos->n_out; i++)
+    {
+        le_put_u64(hdr + 56 + 8 * i, pos->out_off[i]);
+    }
+    le_put_u64(hdr + 184, stew_ctx_state_size(snap));
+    for (int i = 0; i < pos->n_in; i++)
+    {
+        le_put_u64(hdr + 192 + 16 * i, pos->in_size[i]);
+        le_put_u64(hdr + 200 + 16 * i, pos->in_mtime[i]);
+    }
+
+    ckpt_sink_t sink = { fd, 0 };
+    le_writer_t w = { ckpt_sink, &sink, block, STEW_CKPT_BLOCK, 0, 1 };
+    le_write(&w, hdr, STEW_CKPT_HEADER);
+    int ok = stew_ctx_state_write(snap, &w) && le_flush(&w);
+    free(block);
+    uint8_t tail[8];
+    le_put_u64(tail, sink.hash);
+    return ok && ckpt_write_all(fd, tail, 8);
+}
+
+// outputs first, then the checkpoint pointing into them
+static int ckpt_write(stew_ckpt_t *ck)
+{
+    int ok = 1;
+    for (int i = 0; ok && i < ck->n_fds; i++)
+    {
+        ok = !fdatasync(ck->fds[i]);
+    }
+    int fd = ok ? open(ck->tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    ok = fd >= 0 && ckpt_encode(fd, ck->snap, &ck->pos) && !fsync(fd);
+    if (fd >= 0) ok = !close(fd) && ok;
+    return ok && !rename(ck->tmp, ck->fname);
+}
+
+static void *ckpt_run(void *arg)
+{
+    stew_ckpt_t *ck = (stew_ckpt_t *)arg;
+    pthread_mutex_lock(&ck->lock);
+    for (;;)
+    {
+        while (!ck->busy && !ck->stop) pthread_cond_wait(&ck->cond, &ck->lock);
+        if (!ck->busy) break;
+        pthread_mutex_unlock(&ck->lock);
+
+        int ok = ckpt_write(ck);
+        if (!ok) log_warn("Couldn't write checkpoint %s", ck->fname);
+
+        pthread_mutex_lock(&ck->lock);
+        ck->failed |= !ok;
+        stew_ctx_destroy(ck->snap);
+        ck->snap = NULL;
+        ck->busy = 0;
+        pthread_cond_broadcast(&ck->cond);
+    }
+    pthread_mutex_unlock(&ck->lock);
+    return NULL;
+}
+
+stew_ckpt_t *stew_ckpt_start(const char *fname)
+{
+    stew_ckpt_t *ck = (stew_ckpt_t *)calloc(1, sizeof(stew_ckpt_t));
+    if (!ck)
+    {
+        return NULL;
+    }
+    size_t l = strlen(fname);
+    ck->fname = strdup(fname);
+    ck->tmp = (char *)malloc(l + 5);
+    if (!ck->fname || !ck->tmp)
+    {
+        free(ck->fname);
+        free(ck->tmp);
+        free(ck);
+        return NULL;
+    }
+    snprintf(ck->tmp, l + 5, "%s.tmp", fname);
+    pthread_mutex_init(&ck->lock, NULL);
+    pthread_cond_init(&ck->cond, NULL);
+    if (pthread_create(&ck->thread, NULL, ckpt_run, ck))
+    {
+        pthread_mutex_destroy(&ck->lock);
+        pthread_cond_destroy(&ck->cond);
+        free(ck->fname);
+        free(ck->tmp);
+        free(ck);
+        return NULL;
+    }
+    return ck;
+}
+
+int stew_ckpt_submit(stew_ckpt_t *ck, const stew_ctx_t *ctx, const stew_ckpt_pos_t *pos,
+                     const int *out_fds, int n_out)
+{
+    pthread_mutex_lock(&ck->lock);
+    int busy = ck->busy;
+    pthread_mutex_unlock(&ck->lock);
+    if (busy)
+    {
+        return 0;
+    }
+
+    // only a plain copy here, encoding and hashing it is left to the writer
+    stew_ctx_t *snap = stew_ctx_clone(ctx);
+    if (!snap)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&ck->lock);
+    ck->snap = snap;
+    ck->pos = *pos;
+    ck->n_fds = n_out < STEW_CKPT_MAX_OUTPUTS ? n_out : STEW_CKPT_MAX_OUTPUTS;
+    memcpy(ck->fds, out_fds, ck->n_fds * sizeof(int));
+    ck->busy = 1;
+    pthread_cond_broadcast(&ck->cond);
+    pthread_mutex_unlock(&ck->lock);
+    return 1;
+}
+
+// size and modification time of a file
+static int ckpt_stat(const char *fname, uint64_t *size, uint64_t *mtime)
+{
+    struct stat st;
+    if (stat(fname, &st))
+    {
+        return 0;
+    }
+    *size = st.st_size;
+    *mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+    return 1;
+}
+
+int stew_ckpt_stat_inputs(stew_ckpt_pos_t *pos, const char *const *fnames)
+{
+    for (int i = 0; i < pos->n_in; i++)
+    {
+        if (!ckpt_stat(fnames[i], &pos->in_size[i], &pos->in_mtime[i])) return 0;
+    }
+    return 1;
+}
+
+int stew_ckpt_same_inputs(const stew_ckpt_pos_t *pos, const char *const *fnames)
+{
+    for (int i = 0; i < pos->n_in; i++)
+    {
+        uint64_t size, mtime;
+        if (!ckpt_stat(fnames[i], &size, &mtime) || size != pos->in_size[i] || mtime != pos->in_mtime[i])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int stew_ckpt_stop(stew_ckpt_t *ck)
+{
+    if (!ck)
+    {
+        return 1;
+    }
+    pthread_mutex_lock(&ck->lock);
+    ck->stop = 1;
+    pthread_cond_broadcast(&ck->cond);
+    pthread_mutex_unlock(&ck->lock);
+    pthread_join(ck->thread, NULL);
+
+    int ok = !ck->failed;
+    pthread_mutex_destroy(&ck->lock);
+    pthread_cond_destroy(&ck->cond);
+    free(ck->fname);
+    free(ck->tmp);
+    free(ck);
+    return ok;
+}
+
+int stew_ckpt_load(const char *fname, stew_ctx_t *ctx, stew_ckpt_pos_t *pos)
+{
+    FILE *fp = fopen(fname, "rb");
+    if (!fp)
+    {
+        return 0;
+    }
+    struct stat st;
+    uint8_t *img = NULL;
+    size_t len = 0;
+    if (!fstat(fileno(fp), &st) && st.st_size >= STEW_CKPT_HEADER + 8)
+    {
+        len = st.st_size;
+        img = (uint8_t *)malloc(len);
+    }
+    int ok = img && fread(img, 1, len, fp) == len;
+    fclose(fp);
+
+    ok = ok && !memcmp(img, STEW_CKPT_MAGIC, 8) &&
+         le_get_u32(img + 8) == STEW_CKPT_VERSION &&
+         le_get_u64(img + len - 8) == ckpt_hash(img, len - 8) &&
+         le_get_u32(img + 12) <= STEW_CKPT_MAX_INPUTS && le_get_u32(img + 16) <= STEW_CKPT_MAX_OUTPUTS &&
+         le_get_u64(img + 184) == len - STEW_CKPT_HEADER - 8;
+    if (ok)
+    {
+        memset(pos, 0, sizeof(*pos));
+        pos->n_in = le_get_u32(img + 12);
+        pos->n_out = le_get_u32(img + 16);
+        for (int i = 0; i < pos->n_in; i++)
+        {
+            pos->in_off[i] = le_get_u64(img + 24 + 16 * i);
+            pos->in_last[i] = (int)le_get_u32(img + 32 + 16 * i);
+            pos->in_size[i] = le_get_u64(img + 192 + 16 * i);
+            pos->in_mtime[i] = le_get_u64(img + 200 + 16 * i);
+        }
+        for (int i = 0; i < pos->n_out; i++)
+        {
+            pos->out_off[i] = le_get_u64(img + 56 + 8 * i);
+        }
+        ok = stew_ctx_state_load(ctx, img + STEW_CKPT_HEADER, len - STEW_CKPT_HEADER - 8);
+    }
+    free(img);
+    return ok;
+}
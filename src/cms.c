@@ -0,0 +1,197 @@
+//
+// K-mer abundance - a cache-blocked count-min sketch.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <cms.h>
+#include <kmer.h>
+#include <lebytes.h>
+
+struct stew_cms_s {
+    uint8_t *blocks;        // n_blocks of STEW_CMS_BLOCK bytes, cache aligned
+    size_t n_blocks;        // a power of two
+    int bits;               // counter width
+    int row_bits;           // log2 of the counters of a row in a block
+};
+
+stew_cms_t *stew_cms_create(size_t bytes, int bits)
+{
+    if (bits != 8 && bits != 16)
+    {
+        return NULL;
+    }
+    stew_cms_t *c = (stew_cms_t *)calloc(1, sizeof(stew_cms_t));
+    if (!c)
+    {
+        return NULL;
+    }
+    c->bits = bits;
+    c->row_bits = bits == 8 ? 4 : 3; // 16 or 8 counters a row
+    c->n_blocks = 1;
+    while (c->n_blocks * 2 * STEW_CMS_BLOCK <= bytes) c->n_blocks *= 2;
+    if (posix_memalign((void **)&c->blocks, STEW_CMS_BLOCK, c->n_blocks * STEW_CMS_BLOCK))
+    {
+        free(c);
+        return NULL;
+    }
+    memset(c->blocks, 0, c->n_blocks * STEW_CMS_BLOCK);
+    return c;
+}
+
+uint32_t stew_cms_max_count(const stew_cms_t *c)
+{
+    return c->bits == 8 ? UINT8_MAX : UINT16_MAX;
+}
+
+// the block of a k-mer and its counter in each row, from one mixed hash
+static inline uint8_t *cms_block(const stew_cms_t *c, uint64_t h, unsigned *slot)
+{
+    uint64_t x = stew_fmix64((uint32_t)h);
+    for (int r = 0; r < STEW_CMS_ROWS; r++)
+    {
+        slot[r] = (r << c->row_bits) | ((x >> (40 + r * c->row_bits)) & ((1u << c->row_bits) - 1));
+    }
+    return c->blocks + (x & (c->n_blocks - 1)) * STEW_CMS_BLOCK;
+}
+
+static inline uint32_t cms_count(const stew_cms_t *c, const uint8_t *b, const unsigned *slot)
+{
+    uint32_t min = UINT32_MAX;
+    for (int r = 0; r < STEW_CMS_ROWS; r++)
+    {
+        uint32_t v = c->bits == 8 ? b[slot[r]] : ((const uint16_t *)b)[slot[r]];
+        if (v < min) min = v;
+    }
+    return min;
+}
+
+// k-th smallest of v[0..n), reordering v
+static uint32_t cms_select(uint32_t *v, size_t n, size_t k)
+{
+    ptrdiff_t lo = 0, hi = (ptrdiff_t)n - 1, kk = (ptrdiff_t)k;
+    while (lo < hi)
+    {
+        uint32_t pivot = v[lo + (hi - lo) / 2];
+        ptrdiff_t i = lo, j = hi;
+        while (i <= j)
+        {
+            while (v[i] < pivot) i++;
+            while (v[j] > pivot) j--;
+            if (i <= j)
+            {
+                uint32_t t = v[i];
+                v[i++] = v[j];
+                v[j--] = t;
+            }
+        }
+        if (kk <= j) hi = j;
+        else if (kk >= i) lo = i;
+        else break;
+    }
+    return v[kk];
+}
+
+uint32_t stew_cms_median(const stew_cms_t *c, const uint64_t *hashes, size_t n, uint32_t *scratch)
+{
+    if (!n)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned slot[STEW_CMS_ROWS];
+        if (i + 8 < n) // the blocks are scattered, ask for them ahead
+        {
+            unsigned ahead[STEW_CMS_ROWS];
+            __builtin_prefetch(cms_block(c, hashes[i + 8], ahead));
+        }
+        scratch[i] = cms_count(c, cms_block(c, hashes[i], slot), slot);
+    }
+    return cms_select(scratch, n, n / 2);
+}
+
+void stew_cms_add(stew_cms_t *c, const uint64_t *hashes, size_t n)
+{
+    uint32_t max = stew_cms_max_count(c);
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned slot[STEW_CMS_ROWS];
+        uint8_t *b = cms_block(c, hashes[i], slot);
+        uint32_t min = cms_count(c, b, slot);
+        if (min == max)
+        {
+            continue;
+        }
+        for (int r = 0; r < STEW_CMS_ROWS; r++) // conservative update
+        {
+            if (c->bits == 8)
+            {
+                if (b[slot[r]] == min) b[slot[r]]++;
+            }
+            else if (((uint16_t *)b)[slot[r]] == min)
+            {
+                ((uint16_t *)b)[slot[r]]++;
+            }
+        }
+    }
+}
+
+size_t stew_cms_state_size(const stew_cms_t *c)
+{
+    return STEW_CMS_HEADER + c->n_blocks * STEW_CMS_BLOCK;
+}
+
+//   blocks, counter width, then the blocks with little endian counters
+void stew_cms_write(const stew_cms_t *c, le_writer_t *w)
+{
+    le_write_u64(w, c->n_blocks);
+    le_write_u32(w, c->bits);
+    le_write_u32(w, 0);
+    size_t n = c->n_blocks * STEW_CMS_BLOCK;
+    if (c->bits == 8)
+    {
+        le_write(w, c->blocks, n);
+        return;
+    }
+    const uint16_t *v = (const uint16_t *)c->blocks;
+    for (size_t i = 0; i < n / 2; i++)
+    {
+        uint8_t b[2] = { (uint8_t)v[i], (uint8_t)(v[i] >> 8) };
+        le_write(w, b, 2);
+    }
+}
+
+int stew_cms_load(stew_cms_t *c, const uint8_t *buf)
+{
+    if (le_get_u64(buf) != c->n_blocks || le_get_u32(buf + 8) != (uint32_t)c->bits)
+    {
+        return 0;
+    }
+    const uint8_t *b = buf + STEW_CMS_HEADER;
+    size_t n = c->n_blocks * STEW_CMS_BLOCK;
+    if (c->bits == 8)
+    {
+        memcpy(c->blocks, b, n);
+        return 1;
+    }
+    uint16_t *v = (uint16_t *)c->blocks;
+    for (size_t i = 0; i < n / 2; i++, b += 2) v[i] = (uint16_t)(b[0] | b[1] << 8);
+    return 1;
+}
+
+void stew_cms_copy(stew_cms_t *dst, const stew_cms_t *src)
+{
+    memcpy(dst->blocks, src->blocks, src->n_blocks * STEW_CMS_BLOCK);
+}
+
+void stew_cms_destroy(stew_cms_t *c)
+{
+    if (!c)
+    {
+        return;
+    }
+    free(c->blocks);
+    free(c);
+}
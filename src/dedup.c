@@ -0,0 +1,159 @@
+//
+// Duplicate reads - a cuckoo filter of whole-read fingerprints.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <dedup.h>
+#include <lebytes.h>
+
+#define DEDUP_MAX_KICKS 500
+
+struct stew_dedup_s {
+    uint32_t *slots;        // n_buckets * STEW_DEDUP_SLOTS, 0 is empty
+    size_t n_buckets;       // a power of two
+    uint32_t victim;        // the fingerprint the last failed insert left out
+    size_t victim_bucket;
+    uint64_t count;
+};
+
+stew_dedup_t *stew_dedup_create(size_t bytes)
+{
+    stew_dedup_t *d = (stew_dedup_t *)calloc(1, sizeof(stew_dedup_t));
+    if (!d)
+    {
+        return NULL;
+    }
+    d->n_buckets = 1;
+    while (d->n_buckets * 2 * STEW_DEDUP_SLOTS * sizeof(uint32_t) <= bytes) d->n_buckets *= 2;
+    d->slots = (uint32_t *)calloc(d->n_buckets * STEW_DEDUP_SLOTS, sizeof(uint32_t));
+    if (!d->slots)
+    {
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
+// the other bucket a fingerprint may sit in; applied twice it gives back i
+static inline size_t dedup_alt(const stew_dedup_t *d, size_t i, uint32_t fp)
+{
+    return (i ^ (fp * 0x5bd1e995u)) & (d->n_buckets - 1);
+}
+
+static inline int dedup_has(const stew_dedup_t *d, size_t i, uint32_t fp)
+{
+    const uint32_t *b = d->slots + i * STEW_DEDUP_SLOTS;
+    return b[0] == fp || b[1] == fp || b[2] == fp || b[3] == fp;
+}
+
+static inline int dedup_put(stew_dedup_t *d, size_t i, uint32_t fp)
+{
+    uint32_t *b = d->slots + i * STEW_DEDUP_SLOTS;
+    for (int s = 0; s < STEW_DEDUP_SLOTS; s++)
+    {
+        if (!b[s])
+        {
+            b[s] = fp;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int stew_dedup_test_add(stew_dedup_t *d, uint64_t h)
+{
+    uint32_t fp = (uint32_t)(h >> 32);
+    fp += !fp; // 0 marks empty slots
+    size_t i1 = h & (d->n_buckets - 1), i2 = dedup_alt(d, i1, fp);
+    if (dedup_has(d, i1, fp) || dedup_has(d, i2, fp) ||
+        (d->victim == fp && (d->victim_bucket == i1 || d->victim_bucket == i2)))
+    {
+        return 1;
+    }
+    if (d->victim) // full
+    {
+        return 0;
+    }
+    d->count++;
+    if (dedup_put(d, i1, fp) || dedup_put(d, i2, fp))
+    {
+        return 0;
+    }
+    // evict along the chain; the slot kicked is picked from the fingerprint,
+    // so the table only depends on what was added and in what order
+    size_t i = i1;
+    for (int n = 0; n < DEDUP_MAX_KICKS; n++)
+    {
+        uint32_t *slot = d->slots + i * STEW_DEDUP_SLOTS + ((fp ^ n) & (STEW_DEDUP_SLOTS - 1));
+        uint32_t out = *slot;
+        *slot = fp;
+        fp = out;
+        i = dedup_alt(d, i, fp);
+        if (dedup_put(d, i, fp))
+        {
+            return 0;
+        }
+    }
+    d->victim = fp;
+    d->victim_bucket = i;
+    return 0;
+}
+
+uint64_t stew_dedup_count(const stew_dedup_t *d)
+{
+    return d->count;
+}
+
+int stew_dedup_full(const stew_dedup_t *d)
+{
+    return d->victim != 0;
+}
+
+size_t stew_dedup_state_size(const stew_dedup_t *d)
+{
+    return STEW_DEDUP_HEADER + d->n_buckets * STEW_DEDUP_SLOTS * sizeof(uint32_t);
+}
+
+//   buckets, victim and its bucket, count, then the slots
+void stew_dedup_write(const stew_dedup_t *d, le_writer_t *w)
+{
+    le_write_u32(w, (uint32_t)d->n_buckets);
+    le_write_u32(w, d->victim);
+    le_write_u64(w, d->victim_bucket);
+    le_write_u64(w, d->count);
+    for (size_t j = 0; j < d->n_buckets * STEW_DEDUP_SLOTS; j++) le_write_u32(w, d->slots[j]);
+}
+
+int stew_dedup_load(stew_dedup_t *d, const uint8_t *buf)
+{
+    if (le_get_u32(buf) != d->n_buckets || le_get_u64(buf + 8) >= d->n_buckets)
+    {
+        return 0;
+    }
+    d->victim = le_get_u32(buf + 4);
+    d->victim_bucket = le_get_u64(buf + 8);
+    d->count = le_get_u64(buf + 16);
+    const uint8_t *b = buf + STEW_DEDUP_HEADER;
+    for (size_t j = 0; j < d->n_buckets * STEW_DEDUP_SLOTS; j++, b += 4) d->slots[j] = le_get_u32(b);
+    return 1;
+}
+
+void stew_dedup_copy(stew_dedup_t *dst, const stew_dedup_t *src)
+{
+    memcpy(dst->slots, src->slots, src->n_buckets * STEW_DEDUP_SLOTS * sizeof(uint32_t));
+    dst->victim = src->victim;
+    dst->victim_bucket = src->victim_bucket;
+    dst->count = src->count;
+}
+
+void stew_dedup_destroy(stew_dedup_t *d)
+{
+    if (!d)
+    {
+        return;
+    }
+    free(d->slots);
+    free(d);
+}
@@ -0,0 +1,46 @@
+//
+// Read complexity - DUST scores of reads.
+//
+
+#include <stdint.h>
+
+#include <dust.h>
+
+// 2 bit codes of the bases, anything but ACGT reads as A
+static const uint8_t dust_code[256] = {
+        ['C'] = 1, ['G'] = 2, ['T'] = 3,
+        ['c'] = 1, ['g'] = 2, ['t'] = 3,
+};
+
+static inline unsigned dust_triplet(const unsigned char *s)
+{
+    return dust_code[s[0]] << 4 | dust_code[s[1]] << 2 | dust_code[s[2]];
+}
+
+float stew_dust_score(const char *seq, size_t len)
+{
+    const unsigned char *s = (const unsigned char *)seq;
+    if (len < 4)
+    {
+        return 0;
+    }
+    size_t n = len - 2; // triplets
+    size_t w = n < STEW_DUST_WINDOW - 2 ? n : STEW_DUST_WINDOW - 2; // triplets per window
+    uint16_t cnt[64] = { 0 };
+    uint64_t pairs = 0, sum = 0;
+    unsigned t = dust_code[s[0]] << 2 | dust_code[s[1]];
+    for (size_t i = 0; i < n; i++)
+    {
+        t = (t << 2 | dust_code[s[i + 2]]) & 63;
+        pairs += cnt[t]++; // pairs the new triplet makes
+        if (i >= w)
+        {
+            pairs -= --cnt[dust_triplet(s + i - w)];
+        }
+        if (i + 1 >= w)
+        {
+            sum += pairs;
+        }
+    }
+    return (float)((double)sum / (n - w + 1) / (w - 1));
+}
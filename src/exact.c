@@ -0,0 +1,163 @@
+//
+// Exact k-mer sets - sharded open addressing over 2-bit packed k-mers.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <exact.h>
+#include <lebytes.h>
+
+#define EXACT_MIN_REGION 16
+#define EXACT_USED (1ULL << 63) // marks a slot in use, over the 56 bits below the shard
+
+struct stew_exact_s {
+    uint64_t *slots;        // platters * STEW_EXACT_SHARDS regions, 0 is empty
+    size_t region;          // slots a region, a power of two
+    int platters;
+    uint64_t *fill;         // keys held by each region
+    uint8_t full[STEW_EXACT_SHARDS]; // some key of the shard found its region full
+};
+
+stew_exact_t *stew_exact_create(size_t bytes, int platters)
+{
+    stew_exact_t *ex = (stew_exact_t *)calloc(1, sizeof(stew_exact_t));
+    if (!ex)
+    {
+        return NULL;
+    }
+    size_t regions = (size_t)platters * STEW_EXACT_SHARDS;
+    ex->platters = platters;
+    ex->region = EXACT_MIN_REGION;
+    while (regions * ex->region * 2 * sizeof(uint64_t) <= bytes) ex->region *= 2;
+    ex->slots = (uint64_t *)calloc(regions * ex->region, sizeof(uint64_t));
+    ex->fill = (uint64_t *)calloc(regions, sizeof(uint64_t));
+    if (!ex->slots || !ex->fill)
+    {
+        stew_exact_destroy(ex);
+        return NULL;
+    }
+    return ex;
+}
+
+// add key to its region of a platter, 1 if it is new, 2 if it is and didn't fit
+static inline int exact_add(stew_exact_t *ex, int platter, uint64_t x)
+{
+    size_t s = x >> 56, mask = ex->region - 1;
+    size_t r = (size_t)platter * STEW_EXACT_SHARDS + s;
+    uint64_t *slots = ex->slots + r * ex->region;
+    uint64_t want = (x & ((1ULL << 56) - 1)) | EXACT_USED;
+    for (size_t i = x & mask;; i = (i + 1) & mask) // a region is never left without a hole
+    {
+        if (slots[i] == want)
+        {
+            return 0;
+        }
+        if (!slots[i])
+        {
+            if (ex->fill[r] >= ex->region - ex->region / 8) // keep probes short
+            {
+                ex->full[s] = 1;
+                return 2;
+            }
+            slots[i] = want;
+            ex->fill[r]++;
+            return 1;
+        }
+    }
+}
+
+void stew_exact_insert(stew_exact_t *ex, const uint64_t *keys, const uint8_t *plats, size_t n,
+                       int part, int parts, uint8_t *fresh)
+{
+    size_t mask = ex->region - 1;
+    for (size_t j = 0; j < n; j++)
+    {
+        uint64_t y = j + 8 < n ? keys[j + 8] : 0;
+        if (j + 8 < n && (y >> 56) % parts == (uint64_t)part) // the slots are scattered, ask ahead
+        {
+            size_t r = (size_t)plats[j + 8] * STEW_EXACT_SHARDS + (y >> 56);
+            __builtin_prefetch(ex->slots + r * ex->region + (y & mask));
+        }
+        if ((keys[j] >> 56) % parts != (uint64_t)part)
+        {
+            continue;
+        }
+        int added = exact_add(ex, plats[j], keys[j]);
+        if (added) fresh[j] = (uint8_t)added;
+    }
+}
+
+uint64_t stew_exact_count(const stew_exact_t *ex, int platter)
+{
+    uint64_t count = 0;
+    for (int s = 0; s < STEW_EXACT_SHARDS; s++)
+    {
+        count += ex->fill[(size_t)platter * STEW_EXACT_SHARDS + s];
+    }
+    return count;
+}
+
+int stew_exact_full(const stew_exact_t *ex)
+{
+    for (int s = 0; s < STEW_EXACT_SHARDS; s++)
+    {
+        if (ex->full[s]) return 1;
+    }
+    return 0;
+}
+
+size_t stew_exact_state_size(const stew_exact_t *ex)
+{
+    return STEW_EXACT_HEADER + (size_t)ex->platters * STEW_EXACT_SHARDS * ex->region * sizeof(uint64_t);
+}
+
+//   slots a region, platters, whether some key was left out, then the slots
+void stew_exact_write(const stew_exact_t *ex, le_writer_t *w)
+{
+    le_write_u64(w, ex->region);
+    le_write_u32(w, ex->platters);
+    le_write_u32(w, stew_exact_full(ex));
+    size_t n = (size_t)ex->platters * STEW_EXACT_SHARDS * ex->region;
+    for (size_t i = 0; i < n; i++) le_write_u64(w, ex->slots[i]);
+}
+
+int stew_exact_load(stew_exact_t *ex, const uint8_t *buf)
+{
+    if (le_get_u64(buf) != ex->region || le_get_u32(buf + 8) != (uint32_t)ex->platters)
+    {
+        return 0;
+    }
+    size_t regions = (size_t)ex->platters * STEW_EXACT_SHARDS;
+    const uint8_t *b = buf + STEW_EXACT_HEADER;
+    for (size_t i = 0; i < regions * ex->region; i++, b += 8) ex->slots[i] = le_get_u64(b);
+    for (size_t r = 0; r < regions; r++)
+    {
+        uint64_t fill = 0;
+        for (size_t i = 0; i < ex->region; i++) fill += ex->slots[r * ex->region + i] != 0;
+        ex->fill[r] = fill;
+    }
+    // which shard ran out of room doesn't matter, only that one did
+    memset(ex->full, 0, sizeof(ex->full));
+    ex->full[0] = (uint8_t)le_get_u32(buf + 12);
+    return 1;
+}
+
+void stew_exact_copy(stew_exact_t *dst, const stew_exact_t *src)
+{
+    size_t regions = (size_t)src->platters * STEW_EXACT_SHARDS;
+    memcpy(dst->slots, src->slots, regions * src->region * sizeof(uint64_t));
+    memcpy(dst->fill, src->fill, regions * sizeof(uint64_t));
+    memcpy(dst->full, src->full, sizeof(src->full));
+}
+
+void stew_exact_destroy(stew_exact_t *ex)
+{
+    if (!ex)
+    {
+        return;
+    }
+    free(ex->slots);
+    free(ex->fill);
+    free(ex);
+}
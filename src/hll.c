@@ -26,6 +26,10 @@
 #include <string.h>
 #include <math.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define HLL_MAX(a, b) ((a) > (b) ? (a) : (b))
 
 #undef dprintf
@@ -103,13 +107,36 @@ void hll_add(const hll_t *hll, const char *data, size_t data_len)
         return;
     }
 
+    hll_add_hash(hll, hll->hash_function(data, data_len));
+}
+
+uint8_t hll_add_hash_rank(const hll_t *hll, uint64_t hash64, uint8_t *prev)
+{
+    if (!hll) {
+        *prev = 0;
+        return 0;
+    }
+
     // Per original paper, we need 32bits;
-    const uint32_t hash = hll->hash_function(data, data_len) & 0xFFFFFFFF;
+    const uint32_t hash = hash64 & 0xFFFFFFFF;
     const size_t bucket = hash & (hll->n_buckets - 1);
     const uint8_t nzeros = _hll_count_leading_zeros(hash | (hll->n_buckets - 1)) + 1;
-    hll->buckets[bucket] = HLL_MAX(hll->buckets[bucket], nzeros);
+    *prev = hll->buckets[bucket];
 
     dprintf("hash: %u, bucket: %lu, nzeros+1: %d\n", hash, bucket, nzeros);
+
+    if (nzeros <= *prev) {
+        return 0;
+    }
+
+    hll->buckets[bucket] = nzeros;
+    return nzeros - *prev;
+}
+
+uint8_t hll_add_hash(const hll_t *hll, uint64_t hash64)
+{
+    uint8_t prev;
+    return hll_add_hash_rank(hll, hash64, &prev);
 }
 
 int hll_get_estimate(const hll_t *hll, hll_estimate_t *estimate)
@@ -162,15 +189,58 @@ int hll_get_estimate(const hll_t *hll, hll_estimate_t *estimate)
     return 1;
 }
 
+uint8_t *hll_buckets(const hll_t *hll, size_t *n_buckets)
+{
+    if (!hll) {
+        return 0;
+    }
+
+    if (n_buckets) {
+        *n_buckets = hll->n_buckets;
+    }
+
+    return hll->buckets;
+}
+
+void hll_merge_buckets(uint8_t *dst, const uint8_t *src, size_t n_buckets)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // registers are bytes, a merge is a byte-wise max 16 at a time
+    for (; i + 64 <= n_buckets; i += 64) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(dst + i + 16));
+        __m128i a2 = _mm_loadu_si128((const __m128i *)(dst + i + 32));
+        __m128i a3 = _mm_loadu_si128((const __m128i *)(dst + i + 48));
+        a0 = _mm_max_epu8(a0, _mm_loadu_si128((const __m128i *)(src + i)));
+        a1 = _mm_max_epu8(a1, _mm_loadu_si128((const __m128i *)(src + i + 16)));
+        a2 = _mm_max_epu8(a2, _mm_loadu_si128((const __m128i *)(src + i + 32)));
+        a3 = _mm_max_epu8(a3, _mm_loadu_si128((const __m128i *)(src + i + 48)));
+        _mm_storeu_si128((__m128i *)(dst + i), a0);
+        _mm_storeu_si128((__m128i *)(dst + i + 16), a1);
+        _mm_storeu_si128((__m128i *)(dst + i + 32), a2);
+        _mm_storeu_si128((__m128i *)(dst + i + 48), a3);
+    }
+    for (; i + 16 <= n_buckets; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+        a = _mm_max_epu8(a, _mm_loadu_si128((const __m128i *)(src + i)));
+        _mm_storeu_si128((__m128i *)(dst + i), a);
+    }
+#endif
+
+    for (; i < n_buckets; i++) {
+        dst[i] = HLL_MAX(dst[i], src[i]);
+    }
+}
+
 int hll_merge(const hll_t *hll1, const hll_t *hll2)
 {
     if (hll1->n_buckets != hll2->n_buckets) {
         return 0;
     }
 
-    for (int i = 0; i < hll1->n_buckets; i++) {
-        hll1->buckets[i] = HLL_MAX(hll1->buckets[i], hll2->buckets[i]);
-    }
+    hll_merge_buckets(hll1->buckets, hll2->buckets, hll1->n_buckets);
 
     return 1;
 }
@@ -0,0 +1,314 @@
+//
+// K-mer hashing - ntHash seed tables, masking and subsampling.
+//
+
+#include <kmer.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define NT_A 0x3c8bfbb395c60474ULL
+#define NT_C 0x3193c18562a02b4cULL
+#define NT_G 0x20323ed082572324ULL
+#define NT_T 0x295549f54be24456ULL
+#define NT_N 0x0ULL // every other byte, left to zero initialization
+
+const uint64_t stew_nt_seed[256] = {
+        ['A'] = NT_A, ['C'] = NT_C, ['G'] = NT_G, ['T'] = NT_T,
+        ['a'] = NT_A, ['c'] = NT_C, ['g'] = NT_G, ['t'] = NT_T,
+};
+
+const uint64_t stew_nt_comp_seed[256] = {
+        ['A'] = NT_T, ['C'] = NT_G, ['G'] = NT_C, ['T'] = NT_A,
+        ['a'] = NT_T, ['c'] = NT_G, ['g'] = NT_C, ['t'] = NT_A,
+};
+
+static const uint8_t nt_code[256] = {
+        ['C'] = 1, ['G'] = 2, ['T'] = 3,
+        ['c'] = 1, ['g'] = 2, ['t'] = 3,
+};
+
+void stew_kmers_mask(const char *seq, const char *qual, size_t len, int mask_n, int min_qual,
+                     uint64_t *valid)
+{
+    char q_min = (char)(33 + min_qual - 1);
+    qual = min_qual ? qual : NULL;
+    for (size_t w = 0; w * 64 < len; w++)
+    {
+        size_t base = w * 64, m = len - base < 64 ? len - base : 64;
+        uint64_t bits = 0;
+#ifdef __SSE2__
+        if (m == 64)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                unsigned ok = 0xffff;
+                if (mask_n) // fold lower case onto upper case, then compare
+                {
+                    __m128i b = _mm_loadu_si128((const __m128i *)(seq + base + 16 * c));
+                    __m128i u = _mm_and_si128(b, _mm_set1_epi8((char)0xdf));
+                    __m128i acgt = _mm_or_si128(
+                            _mm_or_si128(_mm_cmpeq_epi8(u, _mm_set1_epi8('A')),
+                                         _mm_cmpeq_epi8(u, _mm_set1_epi8('C'))),
+                            _mm_or_si128(_mm_cmpeq_epi8(u, _mm_set1_epi8('G')),
+                                         _mm_cmpeq_epi8(u, _mm_set1_epi8('T'))));
+                    ok &= _mm_movemask_epi8(acgt);
+                }
+                if (qual) // quality characters are all below 128, signed compare is fine
+                {
+                    __m128i q = _mm_loadu_si128((const __m128i *)(qual + base + 16 * c));
+                    ok &= _mm_movemask_epi8(_mm_cmpgt_epi8(q, _mm_set1_epi8(q_min)));
+                }
+                bits |= (uint64_t)ok << (16 * c);
+            }
+            valid[w] = bits;
+            continue;
+        }
+#endif
+        for (size_t j = 0; j < m; j++)
+        {
+            char c = seq[base + j] & (char)0xdf;
+            int ok = !mask_n || c == 'A' || c == 'C' || c == 'G' || c == 'T';
+            ok &= !qual || qual[base + j] > q_min;
+            bits |= (uint64_t)ok << j;
+        }
+        valid[w] = bits;
+    }
+}
+
+// first base at or after i that isn't valid, len if there is none
+static inline size_t mask_next_bad(const uint64_t *valid, size_t i, size_t len)
+{
+    if (i >= len)
+    {
+        return len;
+    }
+    size_t w = i / 64;
+    uint64_t bad = ~valid[w] & (~0ULL << (i % 64));
+    while (!bad)
+    {
+        if (++w * 64 >= len) return len;
+        bad = ~valid[w];
+    }
+    size_t b = w * 64 + __builtin_ctzll(bad);
+    return b < len ? b : len;
+}
+
+// is the k-mer at i all valid bases? next_bad caches the next invalid base
+static inline int mask_kmer_ok(const uint64_t *valid, size_t i, int k, size_t len, size_t *next_bad)
+{
+    if (!valid)
+    {
+        return 1;
+    }
+    if (*next_bad < i || *next_bad == (size_t)-1)
+    {
+        *next_bad = mask_next_bad(valid, i, len);
+    }
+    return *next_bad >= i + k;
+}
+
+// monotone deque of (position, hash), with the least hash of the window at
+// the front and the leftmost one among equals; windows are at most
+// STEW_SAMPLE_MAX_ARG long
+#define DEQUE_SIZE 256
+
+typedef struct kmer_deque_s {
+    size_t pos[DEQUE_SIZE];
+    uint64_t val[DEQUE_SIZE];
+    unsigned head, tail;
+} kmer_deque_t;
+
+static inline void deque_push(kmer_deque_t *q, size_t pos, uint64_t val)
+{
+    while (q->tail != q->head && q->val[(q->tail - 1) % DEQUE_SIZE] > val) q->tail--;
+    q->pos[q->tail % DEQUE_SIZE] = pos;
+    q->val[q->tail % DEQUE_SIZE] = val;
+    q->tail++;
+}
+
+// drop what slid out of a window starting at first
+static inline void deque_trim(kmer_deque_t *q, size_t first)
+{
+    while (q->pos[q->head % DEQUE_SIZE] < first) q->head++;
+}
+
+// roll to the next k-mer and give the raw ntHash it is ordered by; masked
+// k-mers sort last
+static inline uint64_t kmer_order(stew_kmers_t *it, int canonical, int ok)
+{
+    stew_kmers_next(it);
+    if (!ok)
+    {
+        return UINT64_MAX;
+    }
+    return canonical && it->rh < it->fh ? it->rh : it->fh;
+}
+
+// the platter of a k-mer in the top 32 bits of its hash; hash routing takes
+// the high bits the registers don't use
+static inline uint64_t kmer_route(const stew_params_t *pr, size_t pos, size_t nk, uint64_t hash)
+{
+    uint64_t platter = pr->route == STEW_ROUTE_HASH ? ((hash >> 32) * pr->platters) >> 32 : pos / nk;
+    return platter << 32 | (uint32_t)hash;
+}
+
+// minimizers of every window of w k-mers
+static size_t pick_minimizers(const stew_params_t *pr, const char *seq, size_t nk,
+                              const uint64_t *valid, uint64_t *out)
+{
+    int k = pr->kmer, canonical = pr->canonical;
+    size_t n = nk * pr->platters, len = n + k - 1, picked = 0;
+    size_t w = pr->sample_arg, last = (size_t)-1, next_bad = (size_t)-1, m_bad = (size_t)-1;
+    kmer_deque_t q;
+    stew_kmers_t it;
+    q.head = q.tail = 0;
+    stew_kmers_init(&it, seq, k, STEW_KMERS_NT);
+    for (size_t i = 0; i < n; i++)
+    {
+        deque_push(&q, i, kmer_order(&it, canonical, mask_kmer_ok(valid, i, k, len, &next_bad)));
+        if (i + 1 < w && i + 1 < n) continue;
+        deque_trim(&q, i + 1 >= w ? i + 1 - w : 0);
+        size_t m = q.pos[q.head % DEQUE_SIZE];
+        if (m == last) continue;
+        last = m;
+        if (!mask_kmer_ok(valid, m, k, len, &m_bad)) continue; // the whole window is masked
+        // canonical k-mers go to the platters with the hash they are ordered by
+        out[picked++] = kmer_route(pr, m, nk, canonical ? stew_fmix64(q.val[q.head % DEQUE_SIZE]) :
+                                          CityHash64(seq + m, k));
+    }
+    return picked;
+}
+
+// open syncmers: k-mer i holds s-mers i..i+k-s, and is picked if the least
+// of them is the middle one
+static size_t pick_syncmers(const stew_params_t *pr, const char *seq, size_t nk,
+                            const uint64_t *valid, uint64_t *out)
+{
+    int k = pr->kmer, canonical = pr->canonical;
+    size_t n = nk * pr->platters, len = n + k - 1, picked = 0;
+    size_t s = pr->sample_arg, span = k - s + 1, mid = (k - s) / 2;
+    size_t s_bad = (size_t)-1, k_bad = (size_t)-1;
+    kmer_deque_t q;
+    stew_kmers_t it;
+    q.head = q.tail = 0;
+    stew_kmers_init(&it, seq, s, STEW_KMERS_NT);
+    for (size_t j = 0; j < n + span - 1; j++)
+    {
+        deque_push(&q, j, kmer_order(&it, canonical, mask_kmer_ok(valid, j, s, len, &s_bad)));
+        if (j + 1 < span) continue;
+        size_t i = j + 1 - span;
+        deque_trim(&q, i);
+        if (q.pos[q.head % DEQUE_SIZE] != i + mid || !mask_kmer_ok(valid, i, k, len, &k_bad)) continue;
+        stew_kmers_t one;
+        stew_kmers_init(&one, seq + i, k, stew_kmers_mode(canonical));
+        out[picked++] = kmer_route(pr, i, nk, stew_kmers_next(&one));
+    }
+    return picked;
+}
+
+// every k-mer made of valid bases, a run of them at a time
+static size_t pick_valid(const stew_params_t *pr, const char *seq, size_t nk,
+                         const uint64_t *valid, uint64_t *out)
+{
+    int k = pr->kmer;
+    size_t n = nk * pr->platters, len = n + k - 1, picked = 0;
+    size_t i = 0;
+    while (i < n)
+    {
+        size_t bad = valid ? mask_next_bad(valid, i, len) : len;
+        if (bad < i + k)
+        {
+            i = bad + 1;
+            continue;
+        }
+        size_t end = bad - k + 1 < n ? bad - k + 1 : n;
+        stew_kmers_t it;
+        stew_kmers_init(&it, seq + i, k, stew_kmers_mode(pr->canonical));
+        for (; i < end; i++)
+        {
+            out[picked++] = kmer_route(pr, i, nk, stew_kmers_next(&it));
+        }
+    }
+    return picked;
+}
+
+void stew_kmers_hash_range(const stew_params_t *params, const char *seq, size_t nk, size_t a,
+                           size_t b, uint64_t *out)
+{
+    stew_kmers_t it;
+    int routed = params->route == STEW_ROUTE_HASH;
+    stew_kmers_init(&it, seq + a, params->kmer, stew_kmers_mode(params->canonical));
+    for (size_t s = a; s < b; s++)
+    {
+        uint64_t h = stew_kmers_next(&it);
+        out[s] = routed ? kmer_route(params, s, nk, h) : h;
+    }
+}
+
+size_t stew_kmers_pick(const stew_params_t *params, const char *seq, const char *qual, size_t nk,
+                       uint64_t *scratch, uint64_t *out)
+{
+    size_t len = nk * params->platters + params->kmer - 1;
+    const uint64_t *valid = NULL;
+    if (params->mask_n || (params->min_qual && qual))
+    {
+        stew_kmers_mask(seq, qual, len, params->mask_n, params->min_qual, scratch);
+        valid = scratch;
+    }
+    if (params->sample == STEW_SAMPLE_MINIMIZER)
+    {
+        return pick_minimizers(params, seq, nk, valid, out);
+    }
+    if (params->sample == STEW_SAMPLE_SYNCMER)
+    {
+        return pick_syncmers(params, seq, nk, valid, out);
+    }
+    return pick_valid(params, seq, nk, valid, out);
+}
+
+// platter of a packed k-mer under hash routing, from a mix of its own: the
+// exact sets shard on the top bits of stew_fmix64() of the key
+static inline uint64_t pack_platter(uint64_t key, int platters)
+{
+    return ((stew_fmix64(key ^ 0x9e3779b97f4a7c15ULL) >> 32) * platters) >> 32;
+}
+
+size_t stew_kmers_pack(const stew_params_t *params, const char *seq, const char *qual, size_t nk,
+                       uint64_t *scratch, uint64_t *out, uint8_t *plats)
+{
+    int k = params->kmer;
+    size_t n = nk * params->platters, len = n + k - 1, picked = 0, i = 0;
+    uint64_t mask = (1ULL << 2 * k) - 1;
+    unsigned shift = 2 * (k - 1);
+    const unsigned char *s = (const unsigned char *)seq;
+    int routed = params->route == STEW_ROUTE_HASH;
+    stew_kmers_mask(seq, qual, len, 1, params->min_qual, scratch);
+    while (i < n)
+    {
+        size_t bad = mask_next_bad(scratch, i, len);
+        if (bad < i + k)
+        {
+            i = bad + 1;
+            continue;
+        }
+        size_t end = bad - k + 1 < n ? bad - k + 1 : n;
+        uint64_t f = 0, r = 0; // forward k-mer, and its reverse complement
+        for (size_t j = i; j + 1 < i + k; j++)
+        {
+            f = f << 2 | nt_code[s[j]];
+            r = r >> 2 | (uint64_t)(3 - nt_code[s[j]]) << shift;
+        }
+        for (; i < end; i++)
+        {
+            uint64_t c = nt_code[s[i + k - 1]];
+            f = (f << 2 | c) & mask;
+            r = r >> 2 | (3 - c) << shift;
+            uint64_t key = params->canonical && r < f ? r : f;
+            out[picked] = key;
+            plats[picked++] = (uint8_t)(routed ? pack_platter(key, params->platters) : i / nk);
+        }
+    }
+    return picked;
+}
@@ -22,22 +22,55 @@
 
 #include "log.h"
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
 #define MAX_CALLBACKS 32
+#define ASYNC_MSG_INLINE 240
+#define ASYNC_IDLE_NS 2000000
 
 typedef struct {
     log_LogFn fn;
     void *udata;
     int level;
+    bool is_fp;
 } Callback;
 
+/* One queued event. The message is formatted by the producer (its varargs
+ * don't outlive the call); time stamping, level prefixes and I/O happen on
+ * the logger thread. Messages that don't fit inline go to the heap. */
+typedef struct {
+    size_t seq;
+    int level;
+    int line;
+    const char *file;
+    time_t time;
+    char *big;
+    char msg[ASYNC_MSG_INLINE];
+} Slot;
+
 static struct {
     void *udata;
     log_LockFn lock;
     int level;
     bool quiet;
     Callback callbacks[MAX_CALLBACKS];
+    /* async mode: bounded lock-free multi-producer ring, one consumer */
+    Slot *ring;
+    size_t mask;
+    size_t head;      /* next slot to claim, producers */
+    size_t tail;      /* next slot to drain, consumer */
+    uint64_t dropped;
+    int producers;    /* threads between seeing the ring and enqueueing */
+    int running;
+    pthread_t thread;
 } L;
 
+int log_threshold = LOG_TRACE;
+
 
 static const char *level_strings[] = {
         "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"
@@ -65,7 +98,7 @@ static void stdout_callback(log_Event *ev) {
 #endif
     vfprintf(ev->udata, ev->fmt, ev->ap);
     fprintf(ev->udata, "\n");
-    fflush(ev->udata);
+    if (!L.ring) { fflush(ev->udata); } /* the logger thread flushes once drained */
 }
 
 
@@ -77,7 +110,7 @@ static void file_callback(log_Event *ev) {
             buf, level_strings[ev->level], ev->file, ev->line);
     vfprintf(ev->udata, ev->fmt, ev->ap);
     fprintf(ev->udata, "\n");
-    fflush(ev->udata);
+    if (!L.ring) { fflush(ev->udata); }
 }
 
 
@@ -102,20 +135,34 @@ void log_set_lock(log_LockFn fn, void *udata) {
 }
 
 
+/* lowest level anything would print, checked by the log_* macros before
+ * any argument is evaluated */
+static void update_threshold(void) {
+    int t = L.quiet ? LOG_FATAL + 1 : L.level;
+    for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+        if (L.callbacks[i].level < t) { t = L.callbacks[i].level; }
+    }
+    log_threshold = t;
+}
+
+
 void log_set_level(int level) {
     L.level = level;
+    update_threshold();
 }
 
 
 void log_set_quiet(bool enable) {
     L.quiet = enable;
+    update_threshold();
 }
 
 
-int log_add_callback(log_LogFn fn, void *udata, int level) {
+static int add_callback(log_LogFn fn, void *udata, int level, bool is_fp) {
     for (int i = 0; i < MAX_CALLBACKS; i++) {
         if (!L.callbacks[i].fn) {
-            L.callbacks[i] = (Callback) { fn, udata, level };
+            L.callbacks[i] = (Callback) { fn, udata, level, is_fp };
+            update_threshold();
             return 0;
         }
     }
@@ -123,8 +170,13 @@ int log_add_callback(log_LogFn fn, void *udata, int level) {
 }
 
 
+int log_add_callback(log_LogFn fn, void *udata, int level) {
+    return add_callback(fn, udata, level, false);
+}
+
+
 int log_add_fp(FILE *fp, int level) {
-    return log_add_callback(file_callback, fp, level);
+    return add_callback(file_callback, fp, level, true);
 }
 
 
@@ -137,19 +189,19 @@ static void init_event(log_Event *ev, void *udata) {
 }
 
 
-void log_log(int level, const char *file, int line, const char *fmt, ...) {
+static void dispatch(int level, const char *file, int line, struct tm *time,
+                     const char *fmt, va_list ap) {
     log_Event ev = {
             .fmt   = fmt,
             .file  = file,
             .line  = line,
             .level = level,
+            .time  = time,
     };
 
-    lock();
-
     if (!L.quiet && level >= L.level) {
         init_event(&ev, stderr);
-        va_start(ev.ap, fmt);
+        va_copy(ev.ap, ap);
         stdout_callback(&ev);
         va_end(ev.ap);
     }
@@ -158,11 +210,177 @@ void log_log(int level, const char *file, int line, const char *fmt, ...) {
         Callback *cb = &L.callbacks[i];
         if (level >= cb->level) {
             init_event(&ev, cb->udata);
-            va_start(ev.ap, fmt);
+            va_copy(ev.ap, ap);
             cb->fn(&ev);
             va_end(ev.ap);
         }
     }
+}
+
 
+static void dispatchf(int level, const char *file, int line, struct tm *time,
+                      const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    dispatch(level, file, line, time, fmt, ap);
+    va_end(ap);
+}
+
+
+/* Claim a slot (Vyukov's bounded queue). When the ring is full, events
+ * below LOG_WARN are dropped and counted; warnings and errors wait. */
+static Slot *claim(Slot *ring, int level) {
+    size_t pos = __atomic_load_n(&L.head, __ATOMIC_RELAXED);
+    for (;;) {
+        Slot *slot = &ring[pos & L.mask];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&L.head, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                return slot;
+            }
+        } else if (dif < 0) {
+            if (level < LOG_WARN) {
+                __atomic_fetch_add(&L.dropped, 1, __ATOMIC_RELAXED);
+                return NULL;
+            }
+            sched_yield();
+            pos = __atomic_load_n(&L.head, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&L.head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+
+static void enqueue(Slot *ring, int level, const char *file, int line, const char *fmt,
+                    va_list ap) {
+    Slot *slot = claim(ring, level);
+    if (!slot) { return; }
+    size_t pos = slot->seq;
+
+    slot->level = level;
+    slot->file = file;
+    slot->line = line;
+    slot->time = time(NULL);
+    slot->big = NULL;
+    va_list ap2;
+    va_copy(ap2, ap);
+    int n = vsnprintf(slot->msg, sizeof(slot->msg), fmt, ap);
+    if (n >= (int)sizeof(slot->msg) && (slot->big = malloc(n + 1))) {
+        vsnprintf(slot->big, n + 1, fmt, ap2);
+    }
+    va_end(ap2);
+
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+
+/* drain everything queued so far, returns the number of events written */
+static size_t drain(Slot *ring) {
+    size_t n = 0;
+    lock();
+    for (;;) {
+        Slot *slot = &ring[L.tail & L.mask];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != L.tail + 1) { break; }
+        struct tm tm;
+        localtime_r(&slot->time, &tm);
+        dispatchf(slot->level, slot->file, slot->line, &tm, "%s",
+                  slot->big ? slot->big : slot->msg);
+        free(slot->big);
+        __atomic_store_n(&slot->seq, L.tail + L.mask + 1, __ATOMIC_RELEASE);
+        L.tail++;
+        n++;
+    }
+    if (n) {
+        if (!L.quiet) { fflush(stderr); }
+        for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+            if (L.callbacks[i].is_fp) { fflush(L.callbacks[i].udata); }
+        }
+    }
     unlock();
-}
\ No newline at end of file
+    return n;
+}
+
+
+static void *logger(void *arg) {
+    (void)arg;
+    struct timespec idle = { 0, ASYNC_IDLE_NS };
+    while (__atomic_load_n(&L.running, __ATOMIC_ACQUIRE)) {
+        if (!drain(L.ring)) { nanosleep(&idle, NULL); }
+    }
+    drain(L.ring);
+    return NULL;
+}
+
+
+int log_start_async(size_t capacity) {
+    if (L.ring) { return 0; }
+    size_t n = 64;
+    while (n < capacity) { n <<= 1; }
+    Slot *ring = calloc(n, sizeof(Slot));
+    if (!ring) { return -1; }
+    for (size_t i = 0; i < n; i++) { ring[i].seq = i; }
+    L.mask = n - 1;
+    L.head = L.tail = 0;
+    L.dropped = 0;
+    L.running = 1;
+    L.ring = ring;
+    if (pthread_create(&L.thread, NULL, logger, NULL)) {
+        L.ring = NULL;
+        L.running = 0;
+        free(ring);
+        return -1;
+    }
+    return 0;
+}
+
+
+void log_stop_async(void) {
+    if (!L.ring) { return; }
+    __atomic_store_n(&L.running, 0, __ATOMIC_RELEASE);
+    pthread_join(L.thread, NULL);
+    /* other threads may still be logging: from here on they write
+     * synchronously, and the ring is freed once those already past the
+     * check have enqueued (drained here, as one may wait on a full ring) */
+    Slot *ring = L.ring;
+    __atomic_store_n(&L.ring, NULL, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&L.producers, __ATOMIC_SEQ_CST)) {
+        if (!drain(ring)) { sched_yield(); }
+    }
+    drain(ring);
+    free(ring);
+    uint64_t dropped = L.dropped;
+    if (dropped) {
+        log_warn("%llu log events were dropped, the log queue was full",
+                 (unsigned long long)dropped);
+    }
+}
+
+
+uint64_t log_dropped(void) {
+    return __atomic_load_n(&L.dropped, __ATOMIC_RELAXED);
+}
+
+
+void log_log(int level, const char *file, int line, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+
+    Slot *ring = NULL;
+    if (__atomic_load_n(&L.ring, __ATOMIC_ACQUIRE)) {
+        /* announce ourselves, then check the ring wasn't torn down meanwhile */
+        __atomic_add_fetch(&L.producers, 1, __ATOMIC_SEQ_CST);
+        ring = __atomic_load_n(&L.ring, __ATOMIC_SEQ_CST);
+        if (ring) { enqueue(ring, level, file, line, fmt, ap); }
+        __atomic_sub_fetch(&L.producers, 1, __ATOMIC_RELEASE);
+    }
+    if (!ring) {
+        lock();
+        dispatch(level, file, line, NULL, fmt, ap);
+        unlock();
+    }
+
+    va_end(ap);
+}
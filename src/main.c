@@ -1,21 +1,50 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <omp.h>
 #include <log.h>
 #include <ketopt.h>
 #include <kseq.h>
 #include <ascii.h>
+#include <batch.h>
 
 
-#include <hll.h>
-#include <hll_private.h>
+#include <stew.h>
+#include <progress.h>
+#include <trace.h>
+#include <sketch.h>
+#include <kmer.h>
+#include <exact.h>
+#include <checkpoint.h>
 #include <zlib.h>
 
 #define FILE_LOG_LEVEL 0
 #define CONSOLE_LOG_LEVEL 2
 #define LOG_FILE "stew.log"
+#define LOG_QUEUE_SIZE 4096
 #define _VERSION_ "0.1.0"
 
-KSEQ_INIT(gzFile , gzread);
+// counters of the run, fed by the reader and the writer as well
+static stew_stats_t *io_stats;
+static bool io_timing;
+
+// gzread() that accounts for decompressed bytes and decompression time
+static int stew_gzread(gzFile fp, void *buf, unsigned len)
+{
+    uint64_t t0 = io_timing ? stew_now_ns() : 0;
+    int l = gzread(fp, buf, len);
+    if (io_stats)
+    {
+        if (l > 0) stew_stats_add(&io_stats->bytes_in, l);
+        if (io_timing) io_stats->stage_ns[STEW_STAGE_DECOMPRESS] += stew_now_ns() - t0;
+    }
+    return l;
+}
+
+KSEQ_INIT(gzFile , stew_gzread);
 
 // longopts params
 static ko_longopt_t main_longopts[] = {
@@ -27,6 +56,35 @@ static ko_longopt_t main_longopts[] = {
         { "momentum", ko_required_argument, 'm' },
         { "help", ko_no_argument, 'h' },
         { "version", ko_no_argument, 'v' },
+        { "stats", ko_required_argument, 300 },
+        { "progress", ko_required_argument, 301 },
+        { "metrics", ko_required_argument, 302 },
+        { "metrics-interval", ko_required_argument, 303 },
+        { "trace", ko_required_argument, 304 },
+        { "checkpoint", ko_required_argument, 305 },
+        { "checkpoint-interval", ko_required_argument, 306 },
+        { "resume", ko_no_argument, 307 },
+        { "background", ko_required_argument, 308 },
+        { "reference", ko_required_argument, 309 },
+        { "warm-start", ko_required_argument, 310 },
+        { "target-reads", ko_required_argument, 311 },
+        { "target-fraction", ko_required_argument, 312 },
+        { "two-pass", ko_no_argument, 313 },
+        { "canonical", ko_no_argument, 314 },
+        { "minimizer", ko_required_argument, 315 },
+        { "syncmer", ko_required_argument, 316 },
+        { "mask-n", ko_no_argument, 317 },
+        { "min-qual", ko_required_argument, 318 },
+        { "dust", ko_required_argument, 319 },
+        { "dedup", ko_required_argument, 320 },
+        { "near-dup", ko_required_argument, 321 },
+        { "near-dup-max", ko_required_argument, 322 },
+        { "engine", ko_required_argument, 323 },
+        { "coverage", ko_required_argument, 324 },
+        { "cms-mb", ko_required_argument, 325 },
+        { "cms-bits", ko_required_argument, 326 },
+        { "exact-mb", ko_required_argument, 327 },
+        { "route", ko_required_argument, 328 },
         { NULL, 0, 0 }
 };
 
@@ -36,23 +94,375 @@ void log_setup(const char* fname, int f_log_lvl, int c_log_lvl)
     log_set_level(c_log_lvl);
     FILE *lfp = fopen(fname,"w+");
     log_add_fp(lfp,f_log_lvl);
+    // write the log from its own thread, drained on exit
+    if (!log_start_async(LOG_QUEUE_SIZE))
+    {
+        atexit(log_stop_async);
+    }
 }
 
-// write the output
-void stew_write(kseq_t *seq, bool is_fastq, FILE *fp_o)
+// fill a batch with up to max_reads records (0: until the batch is full),
+// returns the number of records read
+size_t stew_fill_batch(kseq_t *seq, read_batch_t *rb, size_t max_reads)
 {
-    if (is_fastq)
+    uint64_t t0 = 0, dec0 = 0;
+    if (io_timing || stew_trace_enabled())
     {
-        fprintf(fp_o, "@%s %s\n", seq->name.s, seq->comment.s);
-        fprintf(fp_o, "%s\n", seq->seq.s);
-        fprintf(fp_o, "+\n");
-        fprintf(fp_o, "%s\n", seq->qual.s);
+        t0 = stew_now_ns();
+        dec0 = io_stats->stage_ns[STEW_STAGE_DECOMPRESS];
     }
-    else
+    read_batch_clear(rb);
+    while ((max_reads ? rb->n < max_reads : !read_batch_full(rb)) && kseq_read(seq) >= 0)
+    {
+        if (!read_batch_push(rb, &seq->name, &seq->comment, &seq->seq, &seq->qual))
+        {
+            log_error("Out of memory while batching reads");
+            break;
+        }
+    }
+    read_batch_seal(rb);
+    uint64_t t1 = io_timing || stew_trace_enabled() ? stew_now_ns() : 0;
+    if (io_timing) // parsing is whatever wasn't spent decompressing
+    {
+        io_stats->stage_ns[STEW_STAGE_PARSE] += t1 - t0 -
+                (io_stats->stage_ns[STEW_STAGE_DECOMPRESS] - dec0);
+    }
+    if (stew_trace_enabled()) // decompression happens inside the parser
+    {
+        stew_trace_span("read+parse", t0, t1, "reads", rb->n);
+    }
+    return rb->n;
+}
+
+// write the records of a batch selected at a level
+void stew_write_batch(const read_batch_t *rb, const uint8_t *keep, int level, FILE *fp_o)
+{
+    uint64_t t0 = io_timing || stew_trace_enabled() ? stew_now_ns() : 0;
+    size_t written = read_batch_write_level(rb, keep, level, fp_o);
+    if (io_timing || stew_trace_enabled())
+    {
+        uint64_t t1 = stew_now_ns();
+        if (io_timing)
+        {
+            io_stats->stage_ns[STEW_STAGE_WRITE] += t1 - t0;
+        }
+        if (stew_trace_enabled())
+        {
+            stew_trace_span("write", t0, t1, "reads", written);
+        }
+    }
+}
+
+// uncompressed offset of the next byte the parser will look at
+uint64_t stew_kseq_tell(const kseq_t *seq)
+{
+    return gztell(seq->f->f) - (seq->f->end - seq->f->begin);
+}
+
+// put the parser back where a checkpoint left it; gzip streams can't seek,
+// so zlib inflates up to the offset, which is still far cheaper than scoring
+int stew_kseq_seek(kseq_t *seq, uint64_t off, int last_char)
+{
+    if (gzseek(seq->f->f, off, SEEK_SET) != (z_off_t)off)
+    {
+        return 0;
+    }
+    ks_rewind(seq->f);
+    seq->last_char = last_char;
+    return 1;
+}
+
+// open an output, or when resuming, cut it back to what the checkpoint
+// had written
+FILE *stew_open_output(const char *fname, const uint64_t *resume_off)
+{
+    if (!resume_off)
+    {
+        return fopen(fname, "w+");
+    }
+    FILE *fp = fopen(fname, "r+");
+    if (!fp || ftruncate(fileno(fp), *resume_off) || fseeko(fp, *resume_off, SEEK_SET))
+    {
+        log_error("Couldn't resume writing %s", fname);
+        if (fp) fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+// hand a checkpoint to the writer thread if one is due, and try again
+// after the next batch if the previous one is still being written
+void stew_checkpoint(stew_ckpt_t *ckpt, uint64_t *next_ns, uint64_t interval_ns,
+                     const stew_ctx_t *ctx, const char *const *in_files, kseq_t **in, int n_in,
+                     FILE **out, int n_out)
+{
+    if (!ckpt || stew_now_ns() < *next_ns)
+    {
+        return;
+    }
+    stew_ckpt_pos_t pos;
+    int fds[STEW_CKPT_MAX_OUTPUTS];
+    memset(&pos, 0, sizeof(pos));
+    pos.n_in = n_in;
+    pos.n_out = n_out;
+    for (int i = 0; i < n_in; i++)
+    {
+        pos.in_off[i] = stew_kseq_tell(in[i]);
+        pos.in_last[i] = in[i]->last_char;
+    }
+    if (!stew_ckpt_stat_inputs(&pos, in_files))
+    {
+        return;
+    }
+    for (int i = 0; i < n_out; i++)
+    {
+        fflush(out[i]);
+        pos.out_off[i] = ftello(out[i]);
+        fds[i] = fileno(out[i]);
+    }
+    if (stew_ckpt_submit(ckpt, ctx, &pos, fds, n_out))
+    {
+        *next_ns = stew_now_ns() + interval_ns;
+    }
+}
+
+// output of a selectivity level: fname with _x<select> before its
+// extension, so out.fq.gz becomes out_x0.3.fq.gz
+char *stew_level_output(const char *fname, float select)
+{
+    const char *base = strrchr(fname, '/');
+    const char *ext = strchr(base ? base + 1 : fname, '.');
+    size_t stem = ext ? (size_t)(ext - fname) : strlen(fname);
+    char tag[32];
+    int tag_l = snprintf(tag, sizeof(tag), "_x%g", select);
+    char *out = (char *)malloc(strlen(fname) + tag_l + 1);
+    if (out)
+    {
+        sprintf(out, "%.*s%s%s", (int)stem, fname, tag, fname + stem);
+    }
+    return out;
+}
+
+// STEW_ENGINE_* of a name, -1 if there is none
+int stew_parse_engine(const char *arg)
+{
+    static const char *names[] = {
+            [STEW_ENGINE_HLL] = "hll", [STEW_ENGINE_CMS] = "cms", [STEW_ENGINE_DELTA] = "delta",
+            [STEW_ENGINE_EXACT] = "exact"
+    };
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+    {
+        if (!strcmp(arg, names[i])) return i;
+    }
+    return -1;
+}
+
+// parse a comma separated list of selectivities, returns how many there
+// were or 0 if the list is malformed or too long
+int stew_parse_levels(const char *arg, float *levels)
+{
+    int n = 0;
+    const char *s = arg;
+    for (;;)
+    {
+        char *end;
+        double v = strtod(s, &end);
+        if (end == s || n == STEW_MAX_LEVELS)
+        {
+            return 0;
+        }
+        levels[n++] = v;
+        if (*end == '\0')
+        {
+            return n;
+        }
+        if (*end != ',')
+        {
+            return 0;
+        }
+        s = end + 1;
+    }
+}
+
+// size of a regular file, 0 if it has none (pipes, devices)
+uint64_t stew_file_size(const char *fname)
+{
+    struct stat st;
+    return !stat(fname, &st) && S_ISREG(st.st_mode) ? (uint64_t)st.st_size : 0;
+}
+
+// re-aim the target mode before scoring a batch of n reads. A read count
+// is kept as the fraction target of the input's read count, which is
+// total_reads when a first pass counted them and is otherwise extrapolated
+// from how far into the (compressed) file the parser is; the context makes
+// up for what the estimate got wrong so far as it firms up.
+void stew_retarget(stew_ctx_t *ctx, gzFile fp, uint64_t in_size, uint64_t total_reads,
+                   uint64_t target, double fraction, size_t n)
+{
+    if (fraction >= 0)
+    {
+        stew_ctx_set_target(ctx, fraction);
+        return;
+    }
+    uint64_t seen = stew_ctx_seen(ctx), kept = stew_ctx_selected(ctx);
+    long off = gzoffset(fp);
+    if (kept >= target || (!in_size && !total_reads))
+    {
+        stew_ctx_set_target(ctx, kept >= target ? 0 : -1);
+        return;
+    }
+    double total = total_reads ? (double)total_reads :
+                   off > 0 ? (double)(seen + n) * in_size / off : 0;
+    stew_ctx_set_target(ctx, total > 0 ? target / total : 1);
+}
+
+// write the --stats report
+int stew_write_stats(const char *fname, const stew_stats_t *st)
+{
+    FILE *fp = fopen(fname, "w");
+    if (!fp)
+    {
+        log_error("Couldn't write stats to %s", fname);
+        return 0;
+    }
+    int ok = stew_stats_write_json(st, fp);
+    return (fclose(fp) == 0) && ok;
+}
+
+// add every read of fname to the sketcher's platters
+int stew_sketch_reads(stew_sketcher_t *sc, const char *fname)
+{
+    gzFile fp = gzopen(fname, "r");
+    if (!fp)
+    {
+        log_error("Couldn't open %s", fname);
+        return 0;
+    }
+    kseq_t *seq = kseq_init(fp);
+    read_batch_t *rb = read_batch_init(READ_BATCH_MAX_READS, 0);
+    int ok = rb != NULL;
+    while (ok && stew_fill_batch(seq, rb, 0) > 0)
+    {
+        ok = stew_sketcher_add_qual(sc, rb->seqs, rb->quals, rb->lens, rb->n);
+    }
+    io_stats->bytes_in_compressed += gzoffset(fp);
+    read_batch_destroy(rb);
+    kseq_destroy(seq);
+    gzclose(fp);
+    return ok;
+}
+
+// sketch the reads of fname on the side, keeping them out of the run's
+// counters
+stew_sketch_t *stew_sketch_file(const stew_params_t *sp, const char *fname)
+{
+    stew_sketcher_t *sc = stew_sketcher_create(sp);
+    if (!sc)
+    {
+        log_error("Couldn't set up the platters");
+        return NULL;
+    }
+    stew_stats_t *run_stats = io_stats;
+    bool run_timing = io_timing;
+    io_stats = stew_sketcher_stats(sc);
+    io_timing = false;
+    stew_sketch_t *sk = stew_sketch_reads(sc, fname) ? stew_sketcher_finish(sc) : NULL;
+    io_stats = run_stats;
+    io_timing = run_timing;
+    stew_sketcher_destroy(sc);
+    return sk;
+}
+
+// platters to measure novelty against: a saved sketch, or a reference
+// sketched on the spot with the run's parameters
+stew_sketch_t *stew_load_background(const stew_params_t *sp, const char *sketch_file,
+                                    const char *ref_file)
+{
+    if (sketch_file)
+    {
+        stew_sketch_t *sk = stew_sketch_open(sketch_file);
+        if (!sk)
+        {
+            log_error("Couldn't read the sketch %s", sketch_file);
+        }
+        return sk;
+    }
+
+    return stew_sketch_file(sp, ref_file);
+}
+
+// stew sketch - add every read of fname to the platters and save them
+int stew_build_sketch(const stew_params_t *sp, const char *fname, const char *sketch_file,
+                      const char *stats_file, int progress_s, const char *metrics_file, int metrics_s)
+{
+    stew_sketcher_t *sc = stew_sketcher_create(sp);
+    if (!sc)
+    {
+        log_error("Couldn't set up the platters");
+        return 1;
+    }
+    io_stats = stew_sketcher_stats(sc);
+    io_timing = sp->timing;
+
+    stew_progress_t *progress = stew_progress_start(io_stats, progress_s, metrics_file, metrics_s);
+    log_debug("Tasting the recipe!...");
+    int ok = stew_sketch_reads(sc, fname);
+    stew_progress_stop(progress);
+
+    stew_sketch_t *sk = ok ? stew_sketcher_finish(sc) : NULL;
+    if (!sk || !stew_sketch_save(sk, sketch_file))
+    {
+        log_error("Couldn't write the sketch to %s", sketch_file);
+        stew_sketch_close(sk);
+        stew_sketcher_destroy(sc);
+        return 1;
+    }
+    log_info("Sketched %llu sequences (%llu kmers) into %s!..", (unsigned long long)sk->n_reads,
+             (unsigned long long)sk->n_kmers, sketch_file);
+    stew_sketch_close(sk);
+
+    ok = !stats_file || stew_write_stats(stats_file, io_stats);
+    stew_sketcher_destroy(sc);
+    return !ok;
+}
+
+// stew merge - combine the sketches of several shards into one
+int stew_merge_sketches(const char *out_file, const char **in_files, int n_in)
+{
+    stew_sketch_t *sk = NULL;
+    for (int i = 0; i < n_in; i++)
     {
-        fprintf(fp_o, ">%s\n", seq->name.s);
-        fprintf(fp_o, "%s\n", seq->seq.s);
+        stew_sketch_t *in = stew_sketch_open(in_files[i]);
+        if (!in)
+        {
+            log_error("Couldn't read the sketch %s", in_files[i]);
+            stew_sketch_close(sk);
+            return 1;
+        }
+        if (!sk)
+        {
+            sk = in; // mapped privately, safe to merge into
+            continue;
+        }
+        int ok = stew_sketch_merge(sk, in);
+        stew_sketch_close(in);
+        if (!ok)
+        {
+            log_error("%s was made with a different k, platters, cups or k-mer options", in_files[i]);
+            stew_sketch_close(sk);
+            return 1;
+        }
+    }
+    if (!stew_sketch_save(sk, out_file))
+    {
+        log_error("Couldn't write the sketch to %s", out_file);
+        stew_sketch_close(sk);
+        return 1;
     }
+    log_info("Merged %d sketches of %llu sequences into %s!..", n_in,
+             (unsigned long long)sk->n_reads, out_file);
+    stew_sketch_close(sk);
+    return 0;
 }
 
 int main(int argc, char *argv[])
@@ -70,6 +480,8 @@ int main(int argc, char *argv[])
                   "Subcommands:\n"
                   "\tS - Single end read mode\n"
                   "\tP - Paired end read mode\n"
+                  "\tsketch - Save the platters of a dataset to a sketch file, no reads are written\n"
+                  "\tmerge - Merge sketches of shards of a dataset into one\n"
                   "\n"
                   "Main options:\n"
                   "\t-t (--threads) - Number of threads [Default: 1]\n"
@@ -79,9 +491,56 @@ int main(int argc, char *argv[])
                   "[Default: 8, Min: 4, Max: 16]\n"
                   "\t-k (--kmers) - Kmer size [Default: 23, Max: 100]\n"
                   "\t-x (--select) - Selectivity for similarity "
-                  "[Default: 0.5, Min: 0 (least selective), Max: 1 (most selective)]\n"
+                  "[Default: 0.5, Min: 0 (least selective), Max: 1 (most selective)]. "
+                  "A comma separated list (up to 8) scores all of them in one pass, "
+                  "writing out_x<select>.* per value\n"
                   "\t-m (--momentum) - Momentum applied to boost score (Useful in bigger "
                   "datasets) [Default: 0.000001, Max 0.001]\n"
+                  "\t--stats FILE - Write per-stage timings and counters of the run as JSON\n"
+                  "\t--progress SECS - Log progress and throughput every SECS seconds [Default: off]\n"
+                  "\t--metrics FILE - Keep a metrics snapshot in FILE, JSON if it ends in .json, "
+                  "Prometheus text otherwise\n"
+                  "\t--metrics-interval SECS - Seconds between metrics snapshots [Default: 10]\n"
+                  "\t--trace FILE - Write a Chrome trace-event timeline of the pipeline stages\n"
+                  "\t--checkpoint FILE - Periodically save the run's state to FILE (needs up to "
+                  "twice the memory)\n"
+                  "\t--checkpoint-interval SECS - Seconds between checkpoints [Default: 600]\n"
+                  "\t--resume - Continue from the --checkpoint FILE of an interrupted run\n"
+                  "\t--background SKETCH - Only keep reads that add diversity beyond a saved sketch\n"
+                  "\t--reference FASTA - Only keep reads that add diversity beyond a reference\n"
+                  "\t--warm-start SKETCH - Continue selection from the platters of a sketch\n"
+                  "\t--target-reads N - Select N reads (pairs), adapting the threshold as reads stream in\n"
+                  "\t--target-fraction F - Select a fraction F of the reads, adapting the threshold\n"
+                  "\t--two-pass - Sketch the whole input first, then select with scores calibrated "
+                  "to it (reads the input twice)\n"
+                  "\t--canonical - Count a kmer and its reverse complement as the same kmer "
+                  "(unstranded libraries)\n"
+                  "\t--minimizer W - Only sketch the minimizer of every window of W kmers\n"
+                  "\t--syncmer S - Only sketch open syncmers: kmers whose smallest S-mer is the "
+                  "middle one\n"
+                  "\t--mask-n - Skip kmers holding a base other than ACGT\n"
+                  "\t--min-qual Q - Skip kmers holding a base of quality below Q (FASTQ) "
+                  "[Default: 0, Max: 93]\n"
+                  "\t--dust T - Reject reads of a DUST score above T before hashing them "
+                  "[Default: off, random ~0.5, tandem repeats 10-15, homopolymers 31]\n"
+                  "\t--dedup MB - Skip exact duplicate reads (pairs) unscored, remembering reads in "
+                  "MB megabytes [Default: off, 4 bytes a read]\n"
+                  "\t--near-dup J - Don't select reads whose kmers are at least J similar (Jaccard, "
+                  "MinHash) to a selected read's [Default: off, Min: 0, Max: 1]\n"
+                  "\t--near-dup-max N - Selected reads remembered for --near-dup, about 100 bytes each "
+                  "[Default: 1000000]\n"
+                  "\t--engine hll|cms|delta|exact - Select reads for novelty (hll), normalize coverage "
+                  "with a count-min sketch (cms), select for novelty counted from register raises, "
+                  "without estimating cardinalities (delta), or counted exactly (exact, k up to 31) "
+                  "[Default: hll]\n"
+                  "\t--coverage C - cms: select reads until the median count of their kmers reaches C "
+                  "[Default: 20]\n"
+                  "\t--cms-mb MB - cms: memory for kmer counts [Default: 64]\n"
+                  "\t--cms-bits B - cms: counter width, 8 (counts to 255) or 16 [Default: 8]\n"
+                  "\t--exact-mb MB - exact: memory for the kmer sets, about 9 bytes a distinct kmer "
+                  "[Default: 1024]\n"
+                  "\t--route pos|hash - Route kmers to platters by their position in the read, or by "
+                  "hash, the same whatever the read length (long reads) [Default: pos]\n"
                   "\t-h (--help) - Print usage\n"
                   "\t-v (--version) - Print version\n"
                   "\n"
@@ -90,6 +549,10 @@ int main(int argc, char *argv[])
                   "\t\tS [input.*] [out.*]\n"
                   "\tP\n"
                   "\t\tP [input1.*] [input2.*] [out1.*] [out2.*]\n"
+                  "\tsketch\n"
+                  "\t\tsketch [input.*] [out.sketch]\n"
+                  "\tmerge\n"
+                  "\t\tmerge [out.sketch] [in1.sketch] [in2.sketch...]\n"
                   "\n";
 
     // set logging
@@ -98,9 +561,23 @@ int main(int argc, char *argv[])
     // argument parsing
     ketopt_t om = KETOPT_INIT, os = KETOPT_INIT;
     int i, j, c;
-    char *sf[2], *pf[4], *params;
+    char *sf[2], *pf[4], *params, *stats_file = NULL, *metrics_file = NULL;
+    char *trace_file = NULL;
+    char *ckpt_file = NULL, *bg_file = NULL, *ref_file = NULL;
+    char *warm_file = NULL;
+    uint64_t target_reads = 0;
+    double target_fraction = -1;
+    int progress_s = 0, metrics_s = 10, ckpt_s = 600, resume = 0, two_pass = 0;
+    int canonical = 0, minimizer = 0, syncmer = 0, mask_n = 0, min_qual = 0, dedup_mb = 0;
+    int minimizer_set = 0, syncmer_set = 0; // given at all, so that 0 is rejected too
     int t = 1, p = 10, cps = 16, k = 23;
-    float x = 0.5, m = 0.000001;
+    float x = 0.5, m = 0.000001, dust = 0, near_dup = 0;
+    int near_dup_max = 1000000;
+    int engine = STEW_ENGINE_HLL, cms_mb = 64, cms_bits = 8, exact_mb = 1024, x_set = 0;
+    int route = STEW_ROUTE_POS;
+    float coverage = 20;
+    float xs[STEW_MAX_LEVELS] = { 0.5 };
+    int n_x = 1;
     while ((c = ketopt(&om, argc, argv, 1, "t:p:k:c:x:m:vh", main_longopts)) >= 0)
     {
         if (c == 't')
@@ -121,12 +598,138 @@ int main(int argc, char *argv[])
         }
         else if (c == 'x')
         {
-            x = om.arg ? atof(om.arg) : 0.5;
+            if (!(n_x = stew_parse_levels(om.arg, xs)))
+            {
+                log_error("-x takes a selectivity or a comma separated list of up to %d",
+                          STEW_MAX_LEVELS);
+                return 1;
+            }
+            x = xs[0];
+            x_set = 1;
         }
         else if (c == 'm')
         {
             m  = om.arg ? atof(om.arg) : 0.000001;
         }
+        else if (c == 300)
+        {
+            stats_file = om.arg;
+        }
+        else if (c == 301)
+        {
+            progress_s = atoi(om.arg);
+        }
+        else if (c == 302)
+        {
+            metrics_file = om.arg;
+        }
+        else if (c == 303)
+        {
+            metrics_s = atoi(om.arg);
+        }
+        else if (c == 304)
+        {
+            trace_file = om.arg;
+        }
+        else if (c == 305)
+        {
+            ckpt_file = om.arg;
+        }
+        else if (c == 306)
+        {
+            ckpt_s = atoi(om.arg);
+        }
+        else if (c == 307)
+        {
+            resume = 1;
+        }
+        else if (c == 308)
+        {
+            bg_file = om.arg;
+        }
+        else if (c == 309)
+        {
+            ref_file = om.arg;
+        }
+        else if (c == 310)
+        {
+            warm_file = om.arg;
+        }
+        else if (c == 311)
+        {
+            target_reads = strtoull(om.arg, NULL, 10);
+        }
+        else if (c == 312)
+        {
+            target_fraction = atof(om.arg);
+        }
+        else if (c == 313)
+        {
+            two_pass = 1;
+        }
+        else if (c == 314)
+        {
+            canonical = 1;
+        }
+        else if (c == 315)
+        {
+            minimizer = atoi(om.arg);
+            minimizer_set = 1;
+        }
+        else if (c == 316)
+        {
+            syncmer = atoi(om.arg);
+            syncmer_set = 1;
+        }
+        else if (c == 317)
+        {
+            mask_n = 1;
+        }
+        else if (c == 318)
+        {
+            min_qual = atoi(om.arg);
+        }
+        else if (c == 319)
+        {
+            dust = atof(om.arg);
+        }
+        else if (c == 320)
+        {
+            dedup_mb = atoi(om.arg);
+        }
+        else if (c == 321)
+        {
+            near_dup = atof(om.arg);
+        }
+        else if (c == 322)
+        {
+            near_dup_max = atoi(om.arg);
+        }
+        else if (c == 323)
+        {
+            engine = stew_parse_engine(om.arg);
+        }
+        else if (c == 324)
+        {
+            coverage = atof(om.arg);
+        }
+        else if (c == 325)
+        {
+            cms_mb = atoi(om.arg);
+        }
+        else if (c == 326)
+        {
+            cms_bits = atoi(om.arg);
+        }
+        else if (c == 327)
+        {
+            exact_mb = atoi(om.arg);
+        }
+        else if (c == 328)
+        {
+            route = !strcmp(om.arg, "pos") ? STEW_ROUTE_POS :
+                    !strcmp(om.arg, "hash") ? STEW_ROUTE_HASH : -1;
+        }
         else if (c == 'v')
         {
             log_info("stew version: %s", _VERSION_);
@@ -148,7 +751,7 @@ int main(int argc, char *argv[])
 
     // check subcommand
     char *sub = argv[om.ind];
-    if (strcmp(sub,"S") && strcmp(sub,"P"))
+    if (strcmp(sub,"S") && strcmp(sub,"P") && strcmp(sub,"sketch") && strcmp(sub,"merge"))
     {
         log_error("No subcommand provided!");
         log_debug(usage);
@@ -163,14 +766,123 @@ int main(int argc, char *argv[])
     p = p > 50 ? log_warn("Platters more than allowed, setting to 50"), 50 : p;
     cps = (cps < 4 || cps > 16) ? log_warn("Cups out of bounds, setting to 8"), 8 : cps;
     k = ( k > 100 || k <= 0) ? log_warn("Kmers out of bound, setting to 100"), 100 : k;
-    x = (x > 1 || x < 0) ?
-            log_warn("Selectivity out of bounds, all sequences will be preserved!"), 0 : x;
+    for (i = 0; i < n_x; i++)
+    {
+        xs[i] = (xs[i] > 1 || xs[i] < 0) ?
+                log_warn("Selectivity out of bounds, all sequences will be preserved!"), 0 : xs[i];
+    }
+    x = xs[0];
     m = (m > 0.001) ? log_warn("Momentum out of bounds, setting to 0.001"), 0.001 : m;
+    if (minimizer_set && syncmer_set)
+    {
+        log_error("--minimizer and --syncmer don't go together");
+        return 1;
+    }
+    if (minimizer_set && !stew_sample_valid(STEW_SAMPLE_MINIMIZER, minimizer, k))
+    {
+        log_error("--minimizer takes a window of 1 to %d kmers", STEW_SAMPLE_MAX_ARG);
+        return 1;
+    }
+    if (syncmer_set && !stew_sample_valid(STEW_SAMPLE_SYNCMER, syncmer, k))
+    {
+        log_error("--syncmer takes an s-mer length of 1 to %d (k)", k);
+        return 1;
+    }
+    if (min_qual < 0 || min_qual > STEW_MAX_QUAL)
+    {
+        log_error("--min-qual takes a phred quality of 0 to %d", STEW_MAX_QUAL);
+        return 1;
+    }
+    if (!(dust >= 0))
+    {
+        log_error("--dust takes a score of 0 or more");
+        return 1;
+    }
+    if (dedup_mb < 0)
+    {
+        log_error("--dedup takes a table size in MB");
+        return 1;
+    }
+    if (!(near_dup >= 0 && near_dup <= 1) || near_dup_max <= 0)
+    {
+        log_error("--near-dup takes a similarity of 0 to 1, --near-dup-max a number of reads");
+        return 1;
+    }
+    if (near_dup > 0 && n_x > 1)
+    {
+        log_error("--near-dup takes a single selectivity");
+        return 1;
+    }
+    if (engine < 0)
+    {
+        log_error("--engine takes hll, cms, delta or exact");
+        return 1;
+    }
+    if (route < 0)
+    {
+        log_error("--route takes pos or hash");
+        return 1;
+    }
+    if (engine == STEW_ENGINE_CMS)
+    {
+        if (cms_mb <= 0 || (cms_bits != 8 && cms_bits != 16) ||
+            !(coverage > 0 && coverage <= (cms_bits == 8 ? UINT8_MAX : UINT16_MAX)))
+        {
+            log_error("--cms-mb takes a size in MB, --cms-bits 8 or 16, and --coverage a count "
+                      "the counters hold");
+            return 1;
+        }
+        if (n_x > 1 || !strcmp(sub, "sketch") || bg_file || ref_file || warm_file || two_pass)
+        {
+            log_error("--engine cms takes a single selectivity, and no sketch, --background, "
+                      "--reference, --warm-start or --two-pass");
+            return 1;
+        }
+        if (!x_set) // keep reads until their k-mers reach coverage
+        {
+            x = xs[0] = 0;
+        }
+    }
+    if (engine == STEW_ENGINE_EXACT)
+    {
+        if (exact_mb <= 0 || k > STEW_EXACT_MAX_KMER)
+        {
+            log_error("--engine exact takes k up to %d, and --exact-mb a size in MB", STEW_EXACT_MAX_KMER);
+            return 1;
+        }
+        // platters are scored on int counts, so none may hold more k-mers
+        if (p > 0 && (uint64_t)exact_mb * ((1 << 20) / sizeof(uint64_t)) / p > INT_MAX)
+        {
+            log_error("--exact-mb %d leaves room for over %d k-mers in each of %d platters, "
+                      "use more platters", exact_mb, INT_MAX, p);
+            return 1;
+        }
+        if (minimizer || syncmer || near_dup > 0 || !strcmp(sub, "sketch") || bg_file || ref_file ||
+            warm_file || two_pass)
+        {
+            log_error("--engine exact takes no --minimizer, --syncmer, --near-dup, sketch, "
+                      "--background, --reference, --warm-start or --two-pass");
+            return 1;
+        }
+    }
 
     log_info(ascii_art);
     log_info("Preparing stew!...");
 
-    if (!strcmp(sub,"S"))
+    if (!strcmp(sub,"merge"))
+    {
+        if (argc - (os.ind + om.ind) < 2)
+        {
+            log_error("Positional arguments should include out.sketch and the "
+                      "sketches to merge");
+            log_debug(usage);
+            return 1;
+        }
+        i = os.ind + om.ind;
+        return stew_merge_sketches(argv[i], (const char **)argv + i + 1, argc - i - 1);
+    }
+
+    if (!strcmp(sub,"S") || !strcmp(sub,"sketch"))
     {
         if (argc - (os.ind + om.ind) != 2)
         {
@@ -224,118 +936,248 @@ int main(int argc, char *argv[])
 
     log_info("Ingredients check completed! Firing up the stove!...");
 
-    // create hll arrays
-    hll_t *hll[p];
+    // create the selection engine
+    stew_params_t sp;
+    stew_params_default(&sp);
+    sp.threads = t;
+    sp.platters = p;
+    sp.cups = cps;
+    sp.kmer = k;
+    sp.select = x;
+    sp.momentum = m;
+    sp.levels = n_x;
+    memcpy(sp.level_select, xs, sizeof(xs));
+    sp.timing = stats_file != NULL;
+    sp.canonical = canonical;
+    sp.sample = minimizer ? STEW_SAMPLE_MINIMIZER : syncmer ? STEW_SAMPLE_SYNCMER : STEW_SAMPLE_ALL;
+    sp.sample_arg = minimizer ? minimizer : syncmer;
+    sp.mask_n = mask_n;
+    sp.min_qual = min_qual;
+    sp.dust = dust;
+    sp.dedup_mb = dedup_mb;
+    sp.near_dup = near_dup;
+    sp.near_dup_max = near_dup_max;
+    sp.engine = engine;
+    sp.coverage = coverage;
+    sp.cms_mb = cms_mb;
+    sp.cms_bits = cms_bits;
+    sp.exact_mb = exact_mb;
+    sp.route = route;
 
-    for (int i = 0; i < p; i++)
+    if (!strcmp(sub,"sketch"))
     {
-        hll[i] = hll_create(cps);
+        return stew_build_sketch(&sp, sf[0], sf[1], stats_file, progress_s, metrics_file, metrics_s);
     }
 
-    log_info("Cups and Platters are ready!...");
+    stew_ctx_t *ctx = stew_ctx_create(&sp);
+    if (!ctx)
+    {
+        log_error("Couldn't set up the platters");
+        return 1;
+    }
+    io_stats = stew_ctx_stats(ctx);
+    io_timing = sp.timing;
 
-    int count = 1, sel_count = 0;
-    if (!strcmp(sub,"S"))
+    // pick up an interrupted run
+    stew_ckpt_pos_t pos;
+    int resumed = 0, n_files = strcmp(sub,"S") ? 2 : 1;
+    const char *in_files[2] = { n_files == 2 ? pf[0] : sf[0], n_files == 2 ? pf[1] : NULL };
+    if (resume)
     {
-        int l;
-        gzFile *sfp = gzopen(sf[0], "r");
-        FILE *sfp_o = fopen(sf[1],"w+");
-        if (!sfp)
+        if (!ckpt_file)
         {
-            log_error("Couldn't open file");
+            log_error("--resume needs the --checkpoint FILE of the run");
             return 1;
         }
+        if (access(ckpt_file, F_OK))
+        {
+            log_warn("No checkpoint in %s yet, starting from the beginning", ckpt_file);
+        }
+        else if (!stew_ckpt_load(ckpt_file, ctx, &pos) || pos.n_in != n_files ||
+                 pos.n_out != n_files * n_x)
+        {
+            log_error("Couldn't resume from %s, it is damaged or was made with other "
+                      "parameters or inputs", ckpt_file);
+            return 1;
+        }
+        else if (!stew_ckpt_same_inputs(&pos, in_files))
+        {
+            log_error("Couldn't resume from %s, the inputs have changed since it was taken", ckpt_file);
+            return 1;
+        }
+        else
+        {
+            resumed = 1;
+            io_stats->bytes_in = pos.in_off[0] + pos.in_off[1];
+            log_info("Resuming after %llu sequences!..", (unsigned long long)stew_ctx_seen(ctx));
+        }
+    }
+    if (!resumed && (bg_file || ref_file)) // a resumed context already has them
+    {
+        stew_sketch_t *bg = stew_load_background(&sp, bg_file, ref_file);
+        if (!bg || !stew_ctx_preload(ctx, bg))
+        {
+            if (bg) log_error("The background sketch was made with a different k, cups or k-mer options, "
+                              "or other platters with --route hash");
+            stew_sketch_close(bg);
+            return 1;
+        }
+        log_info("Platters preloaded with %llu background sequences!..",
+                 (unsigned long long)bg->n_reads);
+        stew_sketch_close(bg);
+    }
+    if (!resumed && warm_file)
+    {
+        stew_sketch_t *warm = stew_sketch_open(warm_file);
+        if (!warm || !stew_ctx_warm_start(ctx, warm))
+        {
+            log_error(warm ? "%s was made with a different k, platters, cups or k-mer options" :
+                      "Couldn't read the sketch %s", warm_file);
+            stew_sketch_close(warm);
+            return 1;
+        }
+        log_info("Picking up after %llu sketched sequences!..", (unsigned long long)warm->n_reads);
+        stew_sketch_close(warm);
+    }
 
-        int *prev_cnt = (int *)calloc(p, sizeof(int));
-        int *curr_cnt = (int *)calloc(p, sizeof(int));
-        int *avg = (int *)calloc(p, sizeof(int));
-
+    // first pass: sketch the whole input to learn where the platters will
+    // end up and how long the longest read is. A resumed context is already
+    // calibrated, it only needs the read count for --target-reads.
+    uint64_t total_reads = 0;
+    if (two_pass && (!resumed || target_reads))
+    {
+        const char *in = strcmp(sub,"S") ? pf[0] : sf[0];
+        if (!stew_file_size(in))
+        {
+            log_error("--two-pass reads the input twice, %s has to be a regular file", in);
+            return 1;
+        }
+        log_info("First pass: tasting the recipe!...");
+        uint64_t t0 = stew_now_ns();
+        stew_sketch_t *sk = stew_sketch_file(&sp, in);
+        if (!sk || (!resumed && !stew_ctx_calibrate(ctx, sk)))
+        {
+            log_error("The first pass over %s failed", in);
+            stew_sketch_close(sk);
+            return 1;
+        }
+        total_reads = sk->n_reads;
+        log_info("First pass: %llu sequences, up to %u kmers per platter, in %.1fs!..",
+                 (unsigned long long)sk->n_reads, sk->max_nk, (stew_now_ns() - t0) / 1e9);
+        stew_sketch_close(sk);
+    }
 
-        kseq_t *seq = kseq_init(sfp);
-        int max_nk = 0, diff_cnt = 0;
-        float corr_cnt = 0.0;
+    // target-size mode; a resumed context carries its controller state
+    if (target_reads || target_fraction >= 0)
+    {
+        if (target_reads && target_fraction >= 0)
+        {
+            log_error("--target-reads and --target-fraction don't go together");
+            return 1;
+        }
+        if (n_x > 1)
+        {
+            log_error("--target-reads and --target-fraction take a single selectivity");
+            return 1;
+        }
+        if (target_reads)
+        {
+            stew_ctx_set_max_selected(ctx, target_reads);
+            if (!total_reads && !stew_file_size(strcmp(sub,"S") ? pf[0] : sf[0]))
+            {
+                log_warn("Can't tell the size of the input, keeping at most %llu reads "
+                         "scoring over the selectivity", (unsigned long long)target_reads);
+            }
+        }
+    }
 
-        log_debug("Reading the recipe!...");
+    stew_ckpt_t *ckpt = NULL;
+    uint64_t ckpt_next = stew_now_ns() + ckpt_s * 1000000000ULL;
+    if (ckpt_file && !(ckpt = stew_ckpt_start(ckpt_file)))
+    {
+        log_error("Couldn't start checkpointing to %s", ckpt_file);
+        return 1;
+    }
 
-        while ((l = kseq_read(seq)) >= 0)
+    // one output (pair) per selectivity level, outs[l * n_files + f]
+    int n_out = n_files * n_x;
+    FILE *outs[STEW_CKPT_MAX_OUTPUTS];
+    for (i = 0; i < n_out; i++)
+    {
+        char *base = strcmp(sub,"S") ? pf[2 + i % n_files] : sf[1];
+        char *fname = n_x > 1 ? stew_level_output(base, xs[i / n_files]) : base;
+        if (!fname || !(outs[i] = stew_open_output(fname, resumed ? &pos.out_off[i] : NULL)))
+        {
+            log_error("Couldn't open file %s", fname ? fname : base);
+            return 1;
+        }
+        if (fname != base)
         {
-            bool is_fastq = false;
-            if (seq->qual.l && seq->comment.l) is_fastq = true;
-            float score = 0.0;
-            long sum_curr = 0;
-            int corr = 0;
-            int _nk = (seq->seq.l - k + 1) / p; // kmer per bucket
-            int _throw = (seq->seq.l - k + 1) % p; // extra kmers
-            int _effk = seq->seq.l - k + 1 - _throw; // effective kmers
+            free(fname);
+        }
+    }
 
+    log_info("Cups and Platters are ready!...");
 
-            if (_nk < max_nk) // is this the largest number of kmers?
-            {
-                corr = max_nk - _nk; // no? apply corrections
-            }
-            else
-            {
-                max_nk = _nk; // yes? assign max
-            }
+    uint8_t *keep = (uint8_t *)malloc(READ_BATCH_MAX_READS * sizeof(uint8_t));
+    if (trace_file)
+    {
+        stew_trace_start();
+        stew_trace_thread_name("main");
+    }
+    stew_progress_t *progress = stew_progress_start(io_stats, progress_s, metrics_file, metrics_s);
 
-            int _p = -1;
-            char *kmer = (char *)malloc(sizeof(char)*k);
+    if (!strcmp(sub,"S"))
+    {
+        gzFile sfp = gzopen(sf[0], "r");
+        if (!sfp)
+        {
+            log_error("Couldn't open file");
+            return 1;
+        }
 
+        kseq_t *seq = kseq_init(sfp);
+        if (resumed && !stew_kseq_seek(seq, pos.in_off[0], pos.in_last[0]))
+        {
+            log_error("Couldn't seek %s to where the checkpoint left it", sf[0]);
+            return 1;
+        }
+        read_batch_t *rb = read_batch_init(READ_BATCH_MAX_READS, 0);
 
-            for (int _s = 0; _s < _effk; _s++) // kmerize and add to HLL
-            {
-                if (!(_s % _nk)) _p++;
-                strncpy(kmer, seq->seq.s+_s, k);
-                hll_add(hll[_p], kmer, k);
-            }
+        log_debug("Reading the recipe!...");
 
-            for (int i = 0; i < p; i++) // estimate the count and calculate the uniqueness score
+        uint64_t in_size = stew_file_size(sf[0]);
+        while (stew_fill_batch(seq, rb, 0) > 0)
+        {
+            if (target_reads || target_fraction >= 0)
             {
-                hll_estimate_t estimate;
-                hll_get_estimate(hll[i], &estimate);
-                curr_cnt[i] = estimate.estimate;
+                stew_retarget(ctx, sfp, in_size, total_reads, target_reads, target_fraction, rb->n);
             }
-
-            // split loop - may lead to lesser cache misses
-
-            for (int i = 0; i < p; i++)
+            if (stew_score_batch_qual(ctx, rb->seqs, rb->quals, rb->lens, rb->n, keep) < 0)
             {
-                diff_cnt = curr_cnt[i] - prev_cnt[i];
-                corr_cnt  = diff_cnt + x*((corr/p)+(1-x)*avg[i]+m*count);
-                // corrections added to unique kmers
-                avg[i] = (avg[i]*(count-1) + corr_cnt) / count;
-                score += (corr_cnt / _nk) * curr_cnt[i];
-                sum_curr += curr_cnt[i];
-                prev_cnt[i] = curr_cnt[i];
+                log_error("Out of memory while scoring reads");
+                return 1;
             }
-
-            score /= sum_curr; // normalize
-
-            if (score > x) // yup! we need this sequence.
+            for (int l = 0; l < n_x; l++)
             {
-                sel_count++;
-                stew_write(seq,is_fastq,sfp_o); // write this
+                stew_write_batch(rb, keep, l, outs[l]); // write these
             }
-            count++;
+            stew_checkpoint(ckpt, &ckpt_next, ckpt_s * 1000000000ULL, ctx, in_files, &seq, 1, outs,
+                            n_out);
         }
         log_debug("Finished processing the recipe!...");
 
+        io_stats->bytes_in_compressed += gzoffset(sfp);
+
         // clean up
+        read_batch_destroy(rb);
         kseq_destroy(seq);
         gzclose(sfp);
-        fclose(sfp_o);
-
-        free(prev_cnt);
-        free(curr_cnt);
-        free(avg);
     }
     else
     {
-        int l1, l2;
-        gzFile *pfp1 = gzopen(pf[0], "r");
-        gzFile *pfp2 = gzopen(pf[1], "r");
-        FILE *pfp_o1 = fopen(pf[2], "w+");
-        FILE *pfp_o2 = fopen(pf[3], "w+");
+        gzFile pfp1 = gzopen(pf[0], "r");
+        gzFile pfp2 = gzopen(pf[1], "r");
 
         if ((!pfp1) || (!pfp2))
         {
@@ -343,103 +1185,128 @@ int main(int argc, char *argv[])
             return 1;
         }
 
-        int *prev_cnt = (int *)calloc(p, sizeof(int));
-        int *curr_cnt = (int *)calloc(p, sizeof(int));
-        int *avg = (int *)calloc(p, sizeof(int));
-
-
         kseq_t *seq1 = kseq_init(pfp1);
         kseq_t *seq2 = kseq_init(pfp2);
-        int max_nk = 0, diff_cnt = 0;
-        float corr_cnt = 0.0;
+        if (resumed && (!stew_kseq_seek(seq1, pos.in_off[0], pos.in_last[0]) ||
+                        !stew_kseq_seek(seq2, pos.in_off[1], pos.in_last[1])))
+        {
+            log_error("Couldn't seek the inputs to where the checkpoint left them");
+            return 1;
+        }
+        kseq_t *seqs[2] = { seq1, seq2 };
+        read_batch_t *rb1 = read_batch_init(READ_BATCH_MAX_READS, 0);
+        read_batch_t *rb2 = read_batch_init(READ_BATCH_MAX_READS, 0);
 
         log_debug("Reading the recipe!...");
 
-        while (((l1 = kseq_read(seq1)) >= 0) && ((l2 = kseq_read(seq2)) >=0))
+        // mates are batched in lockstep, the second batch takes exactly as
+        // many records as the first one got
+        uint64_t in_size = stew_file_size(pf[0]);
+        while (stew_fill_batch(seq1, rb1, 0) > 0 && stew_fill_batch(seq2, rb2, rb1->n) > 0)
         {
-            bool is_fastq = false;
-            if (seq1->qual.l && seq1->comment.l) is_fastq = true;
-            float score = 0.0;
-            long sum_curr = 0;
-            int corr = 0;
-            int _nk = (seq1->seq.l - k + 1) / p; // kmer per bucket
-            int _throw = (seq1->seq.l - k + 1) % p; // extra kmers
-            int _effk = seq1->seq.l - k + 1 - _throw; // effective kmers
-
-
-            if (_nk < max_nk) // is this the largest number of kmers?
+            size_t n = rb1->n < rb2->n ? rb1->n : rb2->n;
+            rb1->n = rb2->n = n;
+            if (target_reads || target_fraction >= 0)
             {
-                corr = max_nk - _nk; // no? apply corrections
+                stew_retarget(ctx, pfp1, in_size, total_reads, target_reads, target_fraction, n);
             }
-            else
+            if (stew_score_batch_pairs(ctx, rb1->seqs, rb1->quals, rb1->lens, rb2->seqs, rb2->lens, n,
+                                       keep) < 0)
             {
-                max_nk = _nk; // yes? assign max
+                log_error("Out of memory while scoring reads");
+                return 1;
             }
-
-            int _p = -1;
-            char *kmer = (char *)malloc(sizeof(char)*k);
-
-
-            for (int _s = 0; _s < _effk; _s++) // kmerize and add to HLL
-            {
-                if (!(_s % _nk)) _p++;
-                strncpy(kmer, seq1->seq.s+_s, k);
-                hll_add(hll[_p], kmer, k);
-            }
-
-            for (int i = 0; i < p; i++) // estimate the count and calculate the uniqueness score
+            for (int l = 0; l < n_x; l++)
             {
-                hll_estimate_t estimate;
-                hll_get_estimate(hll[i], &estimate);
-                curr_cnt[i] = estimate.estimate;
+                stew_write_batch(rb1, keep, l, outs[2 * l]); // write these
+                stew_write_batch(rb2, keep, l, outs[2 * l + 1]);
             }
-
-            // split loop - may lead to lesser cache misses
-            for (int i = 0; i < p; i++)
-            {
-                diff_cnt = curr_cnt[i] - prev_cnt[i];
-                corr_cnt  = diff_cnt + x*((corr/p)+(1-x)*avg[i]+m*count);
-                // corrections added to unique kmers
-                avg[i] = (avg[i]*(count-1) + corr_cnt) / count;
-                score += (corr_cnt / _nk) * curr_cnt[i];
-                sum_curr += curr_cnt[i];
-                prev_cnt[i] = curr_cnt[i];
-            }
-
-            score /= sum_curr; // normalize
-
-            if (score > x) // yup! we need this sequence.
-            {
-                sel_count++;
-                stew_write(seq1, is_fastq, pfp_o1); // write this
-                stew_write(seq2, is_fastq, pfp_o2); // write this
-            }
-            count++;
+            stew_checkpoint(ckpt, &ckpt_next, ckpt_s * 1000000000ULL, ctx, in_files, seqs, 2, outs,
+                            n_out);
         }
         log_debug("Finished processing the recipe!...");
 
+        io_stats->bytes_in_compressed += gzoffset(pfp1) + gzoffset(pfp2);
+
         // clean up
+        read_batch_destroy(rb1);
+        read_batch_destroy(rb2);
         kseq_destroy(seq1);
         kseq_destroy(seq2);
         gzclose(pfp1);
         gzclose(pfp2);
-        fclose(pfp_o1);
-        fclose(pfp_o2);
-
-        free(prev_cnt);
-        free(curr_cnt);
-        free(avg);
     }
-
-    // release HLL allocs
-    for (int i = 0; i < p; i++)
+    // the checkpoint writer syncs the outputs' fds, so it has to be done
+    // with them before they are closed
+    stew_progress_stop(progress);
+    if (!stew_ckpt_stop(ckpt))
+    {
+        log_warn("Some checkpoints couldn't be written to %s", ckpt_file);
+    }
+    for (i = 0; i < n_out; i++)
     {
-            hll_release(hll[i]);
+        io_stats->bytes_out += ftello(outs[i]);
+        fclose(outs[i]);
     }
 
+    free(keep);
+
     // that's all folks!
-    log_info("Selected %d out of %d sequences!..", sel_count, --count);
+    if (n_x > 1)
+    {
+        for (i = 0; i < n_x; i++)
+        {
+            log_info("Selectivity %g: selected %llu out of %llu sequences!..", xs[i],
+                     (unsigned long long)stew_ctx_selected_level(ctx, i),
+                     (unsigned long long)stew_ctx_seen(ctx));
+        }
+    }
+    else
+    {
+        log_info("Selected %llu out of %llu sequences!..",
+                 (unsigned long long)stew_ctx_selected(ctx), (unsigned long long)stew_ctx_seen(ctx));
+    }
+    if (dust > 0)
+    {
+        log_info("Rejected %llu low-complexity sequences unscored",
+                 (unsigned long long)stew_ctx_stats(ctx)->reads_dusted);
+    }
+    if (dedup_mb)
+    {
+        log_info("Skipped %llu duplicate sequences unscored",
+                 (unsigned long long)stew_ctx_stats(ctx)->reads_duplicate);
+    }
+    if (near_dup > 0)
+    {
+        log_info("Left out %llu sequences resembling selected ones",
+                 (unsigned long long)stew_ctx_stats(ctx)->reads_near_duplicate);
+    }
+    if (stew_ctx_stats(ctx)->kmers_unstored)
+    {
+        log_warn("The exact kmer sets ran out of room for %llu new kmers, which counted as seen; "
+                 "raise --exact-mb", (unsigned long long)stew_ctx_stats(ctx)->kmers_unstored);
+    }
+    if (target_reads || target_fraction >= 0)
+    {
+        log_info("Final selectivity threshold: %.4f", stew_ctx_threshold(ctx));
+    }
     log_info("Piping hot stew served! Bon appetit!...");
 
+    if (trace_file && !stew_trace_write(trace_file))
+    {
+        log_error("Couldn't write the trace to %s", trace_file);
+        stew_ctx_destroy(ctx);
+        return 1;
+    }
+
+    if (stats_file && !stew_write_stats(stats_file, io_stats))
+    {
+        stew_ctx_destroy(ctx);
+        return 1;
+    }
+
+    // release the platters
+    stew_ctx_destroy(ctx);
+
     return 0;
 }
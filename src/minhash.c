@@ -0,0 +1,162 @@
+//
+// Near-duplicate reads - MinHash signatures and their LSH index.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <minhash.h>
+#include <lebytes.h>
+
+void stew_minhash_sign(const uint64_t *hashes, size_t n, stew_minhash_t *sig)
+{
+    uint64_t min[STEW_MINHASH_BINS];
+    for (int b = 0; b < STEW_MINHASH_BINS; b++) min[b] = UINT64_MAX;
+    for (size_t i = 0; i < n; i++)
+    {
+        // remix, as the low bits of the k-mer hashes pick HLL buckets
+        uint64_t x = (uint64_t)(uint32_t)hashes[i] * 0x9e3779b97f4a7c15ULL;
+        int b = x >> 60;
+        if (x < min[b]) min[b] = x;
+    }
+    // densify: an empty bin borrows the next full one, marked with how far
+    // it looked so that bins borrowing the same value still differ
+    for (int b = 0; b < STEW_MINHASH_BINS; b++)
+    {
+        int d = 0;
+        while (d < STEW_MINHASH_BINS && min[(b + d) % STEW_MINHASH_BINS] == UINT64_MAX) d++;
+        uint64_t v = d < STEW_MINHASH_BINS ? min[(b + d) % STEW_MINHASH_BINS] : 0;
+        sig->bin[b] = (uint32_t)(v >> 28) + (uint32_t)d * 0x9e3779b9u;
+    }
+}
+
+float stew_minhash_similarity(const stew_minhash_t *a, const stew_minhash_t *b)
+{
+    int same = 0;
+    for (int i = 0; i < STEW_MINHASH_BINS; i++) same += a->bin[i] == b->bin[i];
+    return (float)same / STEW_MINHASH_BINS;
+}
+
+struct stew_lsh_s {
+    stew_minhash_t *sigs;   // ring of max_sigs signatures
+    size_t max_sigs;
+    uint64_t n;             // signatures added so far
+    uint32_t *bands;        // STEW_MINHASH_BANDS tables of n_slots, ring index + 1
+    size_t n_slots;         // a power of two, at least twice max_sigs
+};
+
+stew_lsh_t *stew_lsh_create(size_t max_sigs)
+{
+    if (!max_sigs || max_sigs >= UINT32_MAX)
+    {
+        return NULL;
+    }
+    stew_lsh_t *l = (stew_lsh_t *)calloc(1, sizeof(stew_lsh_t));
+    if (!l)
+    {
+        return NULL;
+    }
+    l->max_sigs = max_sigs;
+    l->n_slots = 1;
+    while (l->n_slots < 2 * max_sigs) l->n_slots *= 2;
+    l->sigs = (stew_minhash_t *)calloc(max_sigs, sizeof(stew_minhash_t));
+    l->bands = (uint32_t *)calloc(l->n_slots * STEW_MINHASH_BANDS, sizeof(uint32_t));
+    if (!l->sigs || !l->bands)
+    {
+        stew_lsh_destroy(l);
+        return NULL;
+    }
+    return l;
+}
+
+// key of a band, from the values so it is the same on any host
+static inline uint64_t lsh_band(const stew_minhash_t *sig, int band)
+{
+    uint64_t h = band;
+    for (int r = 0; r < STEW_MINHASH_ROWS; r++)
+    {
+        h = (h ^ sig->bin[band * STEW_MINHASH_ROWS + r]) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+int stew_lsh_query(const stew_lsh_t *l, const stew_minhash_t *sig, float jaccard)
+{
+    for (int b = 0; b < STEW_MINHASH_BANDS; b++)
+    {
+        uint32_t id = l->bands[b * l->n_slots + (lsh_band(sig, b) & (l->n_slots - 1))];
+        if (id && stew_minhash_similarity(sig, l->sigs + id - 1) >= jaccard)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void stew_lsh_add(stew_lsh_t *l, const stew_minhash_t *sig)
+{
+    size_t at = l->n++ % l->max_sigs;
+    l->sigs[at] = *sig;
+    for (int b = 0; b < STEW_MINHASH_BANDS; b++)
+    {
+        l->bands[b * l->n_slots + (lsh_band(sig, b) & (l->n_slots - 1))] = (uint32_t)at + 1;
+    }
+}
+
+size_t stew_lsh_state_size(const stew_lsh_t *l)
+{
+    return STEW_LSH_HEADER + (l->max_sigs * STEW_MINHASH_BINS + l->n_slots * STEW_MINHASH_BANDS) *
+                             sizeof(uint32_t);
+}
+
+//   max signatures, signatures added, then the signatures and the bands
+void stew_lsh_write(const stew_lsh_t *l, le_writer_t *w)
+{
+    le_write_u64(w, l->max_sigs);
+    le_write_u64(w, l->n);
+    for (size_t i = 0; i < l->max_sigs; i++)
+    {
+        for (int j = 0; j < STEW_MINHASH_BINS; j++) le_write_u32(w, l->sigs[i].bin[j]);
+    }
+    for (size_t i = 0; i < l->n_slots * STEW_MINHASH_BANDS; i++) le_write_u32(w, l->bands[i]);
+}
+
+int stew_lsh_load(stew_lsh_t *l, const uint8_t *buf)
+{
+    if (le_get_u64(buf) != l->max_sigs)
+    {
+        return 0;
+    }
+    const uint8_t *b = buf + STEW_LSH_HEADER + l->max_sigs * STEW_MINHASH_BINS * sizeof(uint32_t);
+    for (size_t i = 0; i < l->n_slots * STEW_MINHASH_BANDS; i++, b += 4)
+    {
+        if (le_get_u32(b) > l->max_sigs) return 0;
+    }
+    l->n = le_get_u64(buf + 8);
+    b = buf + STEW_LSH_HEADER;
+    for (size_t i = 0; i < l->max_sigs; i++)
+    {
+        for (int j = 0; j < STEW_MINHASH_BINS; j++, b += 4) l->sigs[i].bin[j] = le_get_u32(b);
+    }
+    for (size_t i = 0; i < l->n_slots * STEW_MINHASH_BANDS; i++, b += 4) l->bands[i] = le_get_u32(b);
+    return 1;
+}
+
+void stew_lsh_copy(stew_lsh_t *dst, const stew_lsh_t *src)
+{
+    memcpy(dst->sigs, src->sigs, src->max_sigs * sizeof(stew_minhash_t));
+    memcpy(dst->bands, src->bands, src->n_slots * STEW_MINHASH_BANDS * sizeof(uint32_t));
+    dst->n = src->n;
+}
+
+void stew_lsh_destroy(stew_lsh_t *l)
+{
+    if (!l)
+    {
+        return;
+    }
+    free(l->sigs);
+    free(l->bands);
+    free(l);
+}
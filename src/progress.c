@@ -0,0 +1,237 @@
+//
+// Live progress and throughput reporting.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <log.h>
+#include <progress.h>
+
+struct stew_progress_s {
+    const stew_stats_t *st;
+    int interval_s, metrics_interval_s;
+    char *metrics_file, *metrics_tmp;
+    int json;
+    int stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    // counters at the previous progress line, for the current rates
+    uint64_t last_ns, last_reads, last_sel, last_bytes;
+};
+
+typedef struct progress_snap_s {
+    uint64_t now_ns, reads, sel, bytes, kmers;
+} progress_snap_t;
+
+static void progress_sample(const stew_progress_t *pg, progress_snap_t *s)
+{
+    s->now_ns = stew_now_ns();
+    s->reads = __atomic_load_n(&pg->st->reads_in, __ATOMIC_RELAXED);
+    s->sel = __atomic_load_n(&pg->st->reads_out, __ATOMIC_RELAXED);
+    s->bytes = __atomic_load_n(&pg->st->bytes_in, __ATOMIC_RELAXED);
+    s->kmers = __atomic_load_n(&pg->st->kmers_hashed, __ATOMIC_RELAXED);
+}
+
+static void progress_log(stew_progress_t *pg, const progress_snap_t *s)
+{
+    double dt = (s->now_ns - pg->last_ns) * 1e-9;
+    uint64_t dr = s->reads - pg->last_reads, ds = s->sel - pg->last_sel;
+    if (dt <= 0) return;
+
+    log_info("Stirring... %llu reads, %llu selected, %.1f%% selected lately, "
+             "%.0f reads/s, %.2f MB/s",
+             (unsigned long long)s->reads, (unsigned long long)s->sel,
+             dr ? 100.0 * ds / dr : 0.0, dr / dt, (s->bytes - pg->last_bytes) / dt / 1e6);
+
+    pg->last_ns = s->now_ns;
+    pg->last_reads = s->reads;
+    pg->last_sel = s->sel;
+    pg->last_bytes = s->bytes;
+}
+
+// write the snapshot next to the target and rename it over, so a scraper
+// never sees a half written file
+static void progress_metrics(const stew_progress_t *pg, const progress_snap_t *s, int done)
+{
+    FILE *fp = fopen(pg->metrics_tmp, "w");
+    if (!fp)
+    {
+        log_warn("Couldn't write metrics to %s", pg->metrics_tmp);
+        return;
+    }
+
+    double elapsed = (s->now_ns - pg->st->start_ns) * 1e-9;
+    double rps = elapsed > 0 ? s->reads / elapsed : 0;
+    double mbps = elapsed > 0 ? s->bytes / elapsed / 1e6 : 0;
+    double ratio = s->reads ? (double)s->sel / s->reads : 0;
+
+    if (pg->json)
+    {
+        fprintf(fp, "{\"stew_progress\": {\"elapsed_seconds\": %.3f, \"reads_processed\": %llu, "
+                    "\"reads_selected\": %llu, \"selection_ratio\": %.6f, \"reads_per_second\": %.1f, "
+                    "\"input_bytes\": %llu, \"input_mb_per_second\": %.3f, \"kmers_hashed\": %llu, "
+                    "\"done\": %s}}\n",
+                elapsed, (unsigned long long)s->reads, (unsigned long long)s->sel, ratio, rps,
+                (unsigned long long)s->bytes, mbps, (unsigned long long)s->kmers,
+                done ? "true" : "false");
+    }
+    else
+    {
+        fprintf(fp, "# HELP stew_reads_processed_total Reads (pairs) scored.\n"
+                    "# TYPE stew_reads_processed_total counter\n"
+                    "stew_reads_processed_total %llu\n"
+                    "# HELP stew_reads_selected_total Reads (pairs) selected.\n"
+                    "# TYPE stew_reads_selected_total counter\n"
+                    "stew_reads_selected_total %llu\n"
+                    "# HELP stew_input_bytes_total Decompressed input bytes read.\n"
+                    "# TYPE stew_input_bytes_total counter\n"
+                    "stew_input_bytes_total %llu\n"
+                    "# HELP stew_kmers_hashed_total K-mers hashed.\n"
+                    "# TYPE stew_kmers_hashed_total counter\n"
+                    "stew_kmers_hashed_total %llu\n"
+                    "# HELP stew_selection_ratio Fraction of reads selected so far.\n"
+                    "# TYPE stew_selection_ratio gauge\n"
+                    "stew_selection_ratio %.6f\n"
+                    "# HELP stew_reads_per_second Mean reads scored per second.\n"
+                    "# TYPE stew_reads_per_second gauge\n"
+                    "stew_reads_per_second %.1f\n"
+                    "# HELP stew_input_megabytes_per_second Mean decompressed input MB per second.\n"
+                    "# TYPE stew_input_megabytes_per_second gauge\n"
+                    "stew_input_megabytes_per_second %.3f\n"
+                    "# HELP stew_elapsed_seconds Seconds since the run started.\n"
+                    "# TYPE stew_elapsed_seconds gauge\n"
+                    "stew_elapsed_seconds %.3f\n"
+                    "# HELP stew_done Whether the run has finished.\n"
+                    "# TYPE stew_done gauge\n"
+                    "stew_done %d\n",
+                (unsigned long long)s->reads, (unsigned long long)s->sel,
+                (unsigned long long)s->bytes, (unsigned long long)s->kmers,
+                ratio, rps, mbps, elapsed, done);
+    }
+
+    if (fclose(fp) || rename(pg->metrics_tmp, pg->metrics_file))
+    {
+        log_warn("Couldn't update metrics in %s", pg->metrics_file);
+    }
+}
+
+static void *progress_run(void *arg)
+{
+    stew_progress_t *pg = (stew_progress_t *)arg;
+    uint64_t next_log = pg->interval_s ? pg->st->start_ns + pg->interval_s * 1000000000ULL : 0;
+    uint64_t next_metrics = pg->metrics_file ? stew_now_ns() : 0;
+
+    pthread_mutex_lock(&pg->lock);
+    while (!pg->stop)
+    {
+        uint64_t now = stew_now_ns();
+        progress_snap_t snap;
+        if (next_log && now >= next_log)
+        {
+            progress_sample(pg, &snap);
+            progress_log(pg, &snap);
+            while (next_log <= now) next_log += pg->interval_s * 1000000000ULL;
+        }
+        if (next_metrics && now >= next_metrics)
+        {
+            progress_sample(pg, &snap);
+            progress_metrics(pg, &snap, 0);
+            while (next_metrics <= now) next_metrics += pg->metrics_interval_s * 1000000000ULL;
+        }
+
+        uint64_t wake = next_log && (!next_metrics || next_log < next_metrics) ?
+                        next_log : next_metrics;
+        struct timespec ts; // the cond var waits on CLOCK_MONOTONIC, like stew_now_ns()
+        ts.tv_sec = wake / 1000000000ULL;
+        ts.tv_nsec = wake % 1000000000ULL;
+        while (!pg->stop && pthread_cond_timedwait(&pg->cond, &pg->lock, &ts) != ETIMEDOUT);
+    }
+    pthread_mutex_unlock(&pg->lock);
+    return NULL;
+}
+
+stew_progress_t *stew_progress_start(const stew_stats_t *st, int interval_s,
+                                     const char *metrics_file, int metrics_interval_s)
+{
+    if (interval_s <= 0 && !metrics_file)
+    {
+        return NULL;
+    }
+    stew_progress_t *pg = (stew_progress_t *)calloc(1, sizeof(stew_progress_t));
+    if (!pg)
+    {
+        return NULL;
+    }
+    pg->st = st;
+    pg->interval_s = interval_s > 0 ? interval_s : 0;
+    pg->metrics_interval_s = metrics_interval_s > 0 ? metrics_interval_s : 10;
+    // counters restored from a checkpoint aren't part of this run's rates
+    progress_snap_t s0;
+    progress_sample(pg, &s0);
+    pg->last_ns = st->start_ns;
+    pg->last_reads = s0.reads;
+    pg->last_sel = s0.sel;
+    pg->last_bytes = s0.bytes;
+    if (metrics_file)
+    {
+        size_t l = strlen(metrics_file);
+        pg->metrics_file = strdup(metrics_file);
+        pg->metrics_tmp = (char *)malloc(l + 5);
+        if (!pg->metrics_file || !pg->metrics_tmp)
+        {
+            free(pg->metrics_file);
+            free(pg->metrics_tmp);
+            free(pg);
+            return NULL;
+        }
+        snprintf(pg->metrics_tmp, l + 5, "%s.tmp", metrics_file);
+        pg->json = l >= 5 && !strcmp(metrics_file + l - 5, ".json");
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&pg->lock, NULL);
+    pthread_cond_init(&pg->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&pg->thread, NULL, progress_run, pg))
+    {
+        pthread_mutex_destroy(&pg->lock);
+        pthread_cond_destroy(&pg->cond);
+        free(pg->metrics_file);
+        free(pg->metrics_tmp);
+        free(pg);
+        return NULL;
+    }
+    return pg;
+}
+
+void stew_progress_stop(stew_progress_t *pg)
+{
+    if (!pg)
+    {
+        return;
+    }
+    pthread_mutex_lock(&pg->lock);
+    pg->stop = 1;
+    pthread_cond_signal(&pg->cond);
+    pthread_mutex_unlock(&pg->lock);
+    pthread_join(pg->thread, NULL);
+
+    if (pg->metrics_file)
+    {
+        progress_snap_t snap;
+        progress_sample(pg, &snap);
+        progress_metrics(pg, &snap, 1);
+    }
+
+    pthread_mutex_destroy(&pg->lock);
+    pthread_cond_destroy(&pg->cond);
+    free(pg->metrics_file);
+    free(pg->metrics_tmp);
+    free(pg);
+}
@@ -0,0 +1,387 @@
+//
+// Stew sketches - HLL platters saved to disk.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+#include <sketch.h>
+#include <lebytes.h>
+#include <hll.h>
+#include <kmer.h>
+#include <dust.h>
+
+struct stew_sketcher_s {
+    stew_params_t params;
+    hll_t **hll;            // threads x platters, thread t at hll + t * platters
+    uint64_t max_nk;
+    stew_stats_t stats;
+};
+
+static size_t sketch_stride(int cups)
+{
+    size_t n = (size_t)1 << cups;
+    return (n + STEW_SKETCH_ALIGN - 1) & ~(size_t)(STEW_SKETCH_ALIGN - 1);
+}
+
+stew_sketch_t *stew_sketch_create(int kmer, int platters, int cups)
+{
+    if (platters <= 0 || platters > STEW_MAX_PLATTERS ||
+        cups < STEW_MIN_CUPS || cups > STEW_MAX_CUPS || kmer <= 0 || kmer > STEW_MAX_KMER)
+    {
+        return NULL;
+    }
+    stew_sketch_t *sk = (stew_sketch_t *)calloc(1, sizeof(stew_sketch_t));
+    if (!sk)
+    {
+        return NULL;
+    }
+    sk->version = STEW_SKETCH_VERSION;
+    sk->hash_id = STEW_SKETCH_HASH_CITY64;
+    sk->kmer = kmer;
+    sk->platters = platters;
+    sk->cups = cups;
+    sk->flags = STEW_SKETCH_ROUTE_POS;
+    sk->stride = sketch_stride(cups);
+    sk->mem_l = sk->stride * platters;
+    if (posix_memalign(&sk->mem, STEW_SKETCH_ALIGN, sk->mem_l))
+    {
+        free(sk);
+        return NULL;
+    }
+    memset(sk->mem, 0, sk->mem_l);
+    sk->regs = (uint8_t *)sk->mem;
+    return sk;
+}
+
+stew_sketch_t *stew_sketch_open(const char *fname)
+{
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    struct stat st;
+    uint8_t h[STEW_SKETCH_HEADER];
+    if (fstat(fd, &st) || st.st_size < STEW_SKETCH_HEADER ||
+        pread(fd, h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+        memcmp(h, STEW_SKETCH_MAGIC, 8) ||
+        le_get_u32(h + 8) != STEW_SKETCH_VERSION || le_get_u32(h + 12) != STEW_SKETCH_HEADER)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    stew_sketch_t *sk = (stew_sketch_t *)calloc(1, sizeof(stew_sketch_t));
+    if (!sk)
+    {
+        close(fd);
+        return NULL;
+    }
+    sk->version = le_get_u32(h + 8);
+    sk->hash_id = le_get_u32(h + 16);
+    sk->kmer = le_get_u32(h + 20);
+    sk->platters = le_get_u32(h + 24);
+    sk->cups = le_get_u32(h + 28);
+    sk->flags = le_get_u32(h + 32);
+    sk->max_nk = le_get_u32(h + 36);
+    sk->n_reads = le_get_u64(h + 40);
+    sk->n_kmers = le_get_u64(h + 48);
+    sk->stride = le_get_u64(h + 56);
+
+    if ((sk->hash_id != STEW_SKETCH_HASH_CITY64 && sk->hash_id != STEW_SKETCH_HASH_NT_CANON) ||
+        sk->platters == 0 || sk->platters > STEW_MAX_PLATTERS ||
+        sk->cups < STEW_MIN_CUPS || sk->cups > STEW_MAX_CUPS ||
+        sk->kmer == 0 || sk->kmer > STEW_MAX_KMER ||
+        sk->stride != sketch_stride(sk->cups) ||
+        (uint64_t)st.st_size != STEW_SKETCH_HEADER + (uint64_t)sk->stride * sk->platters)
+    {
+        free(sk);
+        close(fd);
+        return NULL;
+    }
+
+    // private and writable: callers may merge into or warm up from the
+    // registers, the file stays as it was
+    sk->mem_l = st.st_size;
+    sk->mem = mmap(NULL, sk->mem_l, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (sk->mem == MAP_FAILED)
+    {
+        free(sk);
+        return NULL;
+    }
+    sk->mapped = 1;
+    sk->regs = (uint8_t *)sk->mem + STEW_SKETCH_HEADER;
+
+    // a register can't hold more than 33 - cups, don't trust the file on it
+    uint8_t max_rank = 33 - sk->cups;
+    for (uint32_t i = 0; i < sk->platters; i++)
+    {
+        const uint8_t *r = stew_sketch_platter(sk, i);
+        for (size_t j = 0; j < ((size_t)1 << sk->cups); j++)
+        {
+            if (r[j] > max_rank)
+            {
+                stew_sketch_close(sk);
+                return NULL;
+            }
+        }
+    }
+    return sk;
+}
+
+int stew_sketch_save(const stew_sketch_t *sk, const char *fname)
+{
+    FILE *fp = fopen(fname, "wb");
+    if (!fp)
+    {
+        return 0;
+    }
+    uint8_t h[STEW_SKETCH_HEADER];
+    memset(h, 0, sizeof(h));
+    memcpy(h, STEW_SKETCH_MAGIC, 8);
+    le_put_u32(h + 8, STEW_SKETCH_VERSION);
+    le_put_u32(h + 12, STEW_SKETCH_HEADER);
+    le_put_u32(h + 16, sk->hash_id);
+    le_put_u32(h + 20, sk->kmer);
+    le_put_u32(h + 24, sk->platters);
+    le_put_u32(h + 28, sk->cups);
+    le_put_u32(h + 32, sk->flags);
+    le_put_u32(h + 36, sk->max_nk);
+    le_put_u64(h + 40, sk->n_reads);
+    le_put_u64(h + 48, sk->n_kmers);
+    le_put_u64(h + 56, sk->stride);
+
+    int ok = fwrite(h, 1, sizeof(h), fp) == sizeof(h) &&
+             fwrite(sk->regs, sk->stride, sk->platters, fp) == sk->platters;
+    return (fclose(fp) == 0) && ok;
+}
+
+void stew_sketch_close(stew_sketch_t *sk)
+{
+    if (!sk)
+    {
+        return;
+    }
+    if (sk->mapped)
+    {
+        munmap(sk->mem, sk->mem_l);
+    }
+    else
+    {
+        free(sk->mem);
+    }
+    free(sk);
+}
+
+int stew_sketch_compatible(const stew_sketch_t *sk, const stew_params_t *params)
+{
+    return sk->hash_id == stew_sketch_hash_id(params) && sk->flags == stew_sketch_flags(params) &&
+           (int)sk->kmer == params->kmer && (int)sk->platters == params->platters &&
+           (int)sk->cups == params->cups;
+}
+
+int stew_sketch_merge(stew_sketch_t *dst, const stew_sketch_t *src)
+{
+    if (dst->hash_id != src->hash_id || dst->flags != src->flags || dst->kmer != src->kmer ||
+        dst->platters != src->platters || dst->cups != src->cups)
+    {
+        return 0;
+    }
+    // platters are contiguous and padded alike, merge them in one sweep
+    hll_merge_buckets(dst->regs, src->regs, dst->stride * dst->platters);
+    dst->n_reads += src->n_reads;
+    dst->n_kmers += src->n_kmers;
+    if (src->max_nk > dst->max_nk)
+    {
+        dst->max_nk = src->max_nk;
+    }
+    return 1;
+}
+
+stew_sketcher_t *stew_sketcher_create(const stew_params_t *params)
+{
+    if (params->platters <= 0 || params->platters > STEW_MAX_PLATTERS ||
+        params->cups < STEW_MIN_CUPS || params->cups > STEW_MAX_CUPS ||
+        params->kmer <= 0 || params->kmer > STEW_MAX_KMER || params->threads <= 0 ||
+        params->min_qual < 0 || params->min_qual > STEW_MAX_QUAL || !(params->dust >= 0) ||
+        !stew_sample_valid(params->sample, params->sample_arg, params->kmer))
+    {
+        return NULL;
+    }
+    stew_sketcher_t *sc = (stew_sketcher_t *)calloc(1, sizeof(stew_sketcher_t));
+    if (!sc)
+    {
+        return NULL;
+    }
+    sc->params = *params;
+    stew_stats_init(&sc->stats);
+
+    int n = params->threads * params->platters;
+    sc->hll = (hll_t **)calloc(n, sizeof(hll_t *));
+    if (!sc->hll)
+    {
+        stew_sketcher_destroy(sc);
+        return NULL;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (!(sc->hll[i] = hll_create(params->cups)))
+        {
+            stew_sketcher_destroy(sc);
+            return NULL;
+        }
+    }
+    return sc;
+}
+
+int stew_sketcher_add(stew_sketcher_t *sc, const char *const *seqs, const size_t *lens, size_t n)
+{
+    return stew_sketcher_add_qual(sc, seqs, NULL, lens, n);
+}
+
+int stew_sketcher_add_qual(stew_sketcher_t *sc, const char *const *seqs, const char *const *quals,
+                           const size_t *lens, size_t n)
+{
+    int k = sc->params.kmer, p = sc->params.platters;
+    uint64_t t0 = sc->params.timing ? stew_now_ns() : 0;
+    uint64_t kmers = 0, dusted = 0;
+    uint64_t max_nk = sc->max_nk;
+    int failed = 0;
+    size_t bases = 0;
+    for (size_t i = 0; i < n; i++) bases += lens[i];
+    // reads a thread takes at a time, fewer as they get longer
+    size_t chunk = bases > STEW_LONG_KMERS / 64 * n ? n * STEW_LONG_KMERS / bases : 64;
+    if (!chunk) chunk = 1;
+
+    // registers only ever take the max, so the order reads are added in
+    // doesn't matter and every thread can fill platters of its own
+#pragma omp parallel num_threads(sc->params.threads) reduction(+:kmers, dusted) reduction(max:max_nk)
+    {
+        hll_t **hll = sc->hll + (size_t)omp_get_thread_num() * p;
+        uint64_t *picks = NULL; // hashes picked from a read, and its masks
+        size_t picks_m = 0;
+#pragma omp for schedule(dynamic, chunk)
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t _nk = lens[i] < (size_t)k ? 0 : (lens[i] - k + 1) / p;
+            if (!_nk) continue;
+            if (sc->params.dust > 0 && stew_dust_score(seqs[i], lens[i]) > sc->params.dust)
+            {
+                dusted++;
+                continue;
+            }
+            if (stew_kmers_routed(&sc->params)) // scored as stew_score_batch() would
+            {
+                size_t words = _nk * p + stew_kmers_scratch(&sc->params, _nk);
+                if (words > picks_m)
+                {
+                    uint64_t *b = (uint64_t *)realloc(picks, words * sizeof(uint64_t));
+                    if (!b)
+                    {
+#pragma omp atomic write
+                        failed = 1;
+                        continue;
+                    }
+                    picks = b;
+                    picks_m = words;
+                }
+                size_t n_picked = _nk * p;
+                if (stew_kmers_filtered(&sc->params))
+                {
+                    n_picked = stew_kmers_pick(&sc->params, seqs[i], quals ? quals[i] : NULL, _nk,
+                                               picks + _nk * p, picks);
+                }
+                else
+                {
+                    stew_kmers_hash_range(&sc->params, seqs[i], _nk, 0, n_picked, picks);
+                }
+                for (size_t j = 0; j < n_picked; j++)
+                {
+                    hll_add_hash(hll[picks[j] >> 32], picks[j]);
+                }
+                kmers += n_picked;
+                _nk = stew_sample_nk(n_picked, p);
+                if (_nk > max_nk) max_nk = _nk;
+                continue;
+            }
+            stew_kmers_t it;
+            stew_kmers_init(&it, seqs[i], k, stew_kmers_mode(sc->params.canonical));
+            for (int _p = 0; _p < p; _p++)
+            {
+                for (size_t _s = 0; _s < _nk; _s++)
+                {
+                    hll_add_hash(hll[_p], stew_kmers_next(&it));
+                }
+            }
+            kmers += _nk * p;
+            if (_nk > max_nk) max_nk = _nk;
+        }
+        free(picks);
+    }
+
+    sc->max_nk = max_nk;
+    stew_stats_add(&sc->stats.kmers_hashed, kmers);
+    stew_stats_add(&sc->stats.reads_dusted, dusted);
+    stew_stats_add(&sc->stats.reads_in, n);
+    if (sc->params.timing)
+    {
+        sc->stats.stage_ns[STEW_STAGE_KMERIZE] += stew_now_ns() - t0;
+    }
+    return !failed;
+}
+
+stew_sketch_t *stew_sketcher_finish(stew_sketcher_t *sc)
+{
+    int p = sc->params.platters;
+    stew_sketch_t *sk = stew_sketch_create(sc->params.kmer, p, sc->params.cups);
+    if (!sk)
+    {
+        return NULL;
+    }
+    for (int i = 0; i < p; i++)
+    {
+        for (int t = 1; t < sc->params.threads; t++)
+        {
+            hll_merge(sc->hll[i], sc->hll[(size_t)t * p + i]);
+        }
+        size_t n_buckets;
+        const uint8_t *regs = hll_buckets(sc->hll[i], &n_buckets);
+        memcpy(stew_sketch_platter(sk, i), regs, n_buckets);
+    }
+    sk->hash_id = stew_sketch_hash_id(&sc->params);
+    sk->flags = stew_sketch_flags(&sc->params);
+    sk->max_nk = sc->max_nk < UINT32_MAX ? (uint32_t)sc->max_nk : UINT32_MAX;
+    sk->n_reads = sc->stats.reads_in;
+    sk->n_kmers = sc->stats.kmers_hashed;
+    return sk;
+}
+
+stew_stats_t *stew_sketcher_stats(stew_sketcher_t *sc)
+{
+    return &sc->stats;
+}
+
+void stew_sketcher_destroy(stew_sketcher_t *sc)
+{
+    if (!sc)
+    {
+        return;
+    }
+    if (sc->hll)
+    {
+        for (int i = 0; i < sc->params.threads * sc->params.platters; i++)
+        {
+            hll_release(sc->hll[i]);
+        }
+    }
+    free(sc->hll);
+    free(sc);
+}
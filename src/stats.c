@@ -0,0 +1,62 @@
+//
+// Per-stage timings and counters of a stew run.
+//
+
+#include <string.h>
+#include <sys/resource.h>
+
+#include <stats.h>
+
+static const char *stage_names[STEW_STAGE_N] = {
+        "decompress", "parse", "kmerize", "estimate", "score", "write"
+};
+
+void stew_stats_init(stew_stats_t *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->start_ns = stew_now_ns();
+}
+
+const char *stew_stage_name(int stage)
+{
+    return stage_names[stage];
+}
+
+static double tv_seconds(struct timeval tv)
+{
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+int stew_stats_write_json(const stew_stats_t *st, FILE *fp)
+{
+    struct rusage ru;
+    memset(&ru, 0, sizeof(ru));
+    getrusage(RUSAGE_SELF, &ru);
+    double user = tv_seconds(ru.ru_utime), sys = tv_seconds(ru.ru_stime);
+
+    fprintf(fp, "{\n  \"stew_stats\": {\n");
+    fprintf(fp, "    \"wall_seconds\": %.6f,\n", (stew_now_ns() - st->start_ns) * 1e-9);
+    fprintf(fp, "    \"cpu_seconds\": %.6f,\n", user + sys);
+    fprintf(fp, "    \"user_seconds\": %.6f,\n", user);
+    fprintf(fp, "    \"sys_seconds\": %.6f,\n", sys);
+    fprintf(fp, "    \"peak_rss_bytes\": %llu,\n", (unsigned long long)ru.ru_maxrss * 1024); // KB on Linux
+    fprintf(fp, "    \"reads_in\": %llu,\n", (unsigned long long)st->reads_in);
+    fprintf(fp, "    \"reads_out\": %llu,\n", (unsigned long long)st->reads_out);
+    fprintf(fp, "    \"reads_dusted\": %llu,\n", (unsigned long long)st->reads_dusted);
+    fprintf(fp, "    \"reads_duplicate\": %llu,\n", (unsigned long long)st->reads_duplicate);
+    fprintf(fp, "    \"reads_near_duplicate\": %llu,\n", (unsigned long long)st->reads_near_duplicate);
+    fprintf(fp, "    \"kmers_hashed\": %llu,\n", (unsigned long long)st->kmers_hashed);
+    fprintf(fp, "    \"register_updates\": %llu,\n", (unsigned long long)st->register_updates);
+    fprintf(fp, "    \"kmers_unstored\": %llu,\n", (unsigned long long)st->kmers_unstored);
+    fprintf(fp, "    \"bytes_in\": %llu,\n", (unsigned long long)st->bytes_in);
+    fprintf(fp, "    \"bytes_in_compressed\": %llu,\n", (unsigned long long)st->bytes_in_compressed);
+    fprintf(fp, "    \"bytes_out\": %llu,\n", (unsigned long long)st->bytes_out);
+    fprintf(fp, "    \"stage_seconds\": {\n");
+    for (int i = 0; i < STEW_STAGE_N; i++)
+    {
+        fprintf(fp, "      \"%s\": %.6f%s\n", stage_names[i], st->stage_ns[i] * 1e-9,
+                i + 1 < STEW_STAGE_N ? "," : "");
+    }
+    fprintf(fp, "    }\n  }\n}\n");
+    return !ferror(fp);
+}
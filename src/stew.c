@@ -0,0 +1,1387 @@
+//
+// libstew - streaming read diversity selection.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+
+#include <stew.h>
+#include <sketch.h>
+#include <trace.h>
+#include <lebytes.h>
+#include <hll.h>
+#include <kmer.h>
+#include <dust.h>
+#include <dedup.h>
+#include <minhash.h>
+#include <cms.h>
+#include <exact.h>
+
+// a scoring engine turns the hashes of a read into its score at each
+// level, and may learn from the read once it has been decided on. It may
+// also see a whole batch once hashed, before any read of it is scored.
+typedef struct stew_engine_s {
+    void (*score)(stew_ctx_t *ctx, const uint64_t *hashes, size_t n_hashes, size_t _nk,
+                  float *scores);
+    void (*decided)(stew_ctx_t *ctx, const uint64_t *hashes, size_t n_hashes, int keep);
+    void (*batch)(stew_ctx_t *ctx, size_t n);
+} stew_engine_t;
+
+static const stew_engine_t *stew_engine(int engine);
+
+// k-mers a to b - 1 of a read, hashed by one thread
+typedef struct stew_range_s {
+    size_t read, a, b;
+} stew_range_t;
+
+// target mode compares scores against a quantile of the last
+// STEW_TARGET_WINDOW of them, picked anew every STEW_TARGET_EVERY scores
+#define STEW_TARGET_WINDOW 2048
+#define STEW_TARGET_EVERY 64
+// reads over which a shortfall (or excess) of selections is made up, and
+// how far it may get before reads are kept (or dropped) whatever they score
+#define STEW_TARGET_HORIZON 256.0
+#define STEW_TARGET_SLACK 8
+
+struct stew_ctx_s {
+    stew_params_t params;
+    const stew_engine_t *engine;
+    hll_t **hll;
+    int *prev_cnt, *curr_cnt, *avg;
+    size_t max_nk;
+    uint64_t count;         // reads scored so far + 1
+    uint64_t batches;       // batches scored so far, labels trace spans
+    // target-size mode, see stew_ctx_set_target()
+    double target;          // fraction to keep, < 0 when off
+    uint64_t max_selected;
+    uint64_t tgt_seen;      // reads passed since target mode began
+    uint64_t tgt_kept;      // and those of them kept
+    double thr;             // threshold, a quantile of the recent scores
+    uint64_t n_scores;      // scores seen in target mode, the last ones are in recent
+    float recent[STEW_TARGET_WINDOW];
+    uint64_t level_selected[STEW_MAX_LEVELS]; // per level, level 0 is in stats
+    stew_dedup_t *dedup;    // reads seen, NULL unless skipping duplicates
+    stew_lsh_t *lsh;        // reads selected, NULL unless skipping near duplicates
+    stew_cms_t *cms;        // k-mer counts of the cms engine
+    double *hip;            // delta engine: new k-mers counted into each platter
+    double *harm;           // delta engine: sum of 2^-register of each platter, the
+                            // chance a new k-mer raises one of its registers times
+                            // the registers
+    stew_exact_t *exact;    // exact engine: the k-mers of each platter
+    uint64_t *exact_cnt;    // exact engine: distinct k-mers in each platter
+    uint32_t *counts;       // counts of a read's k-mers, counts_m entries
+    size_t counts_m;
+    float *card;            // platter cardinalities at the end of the input,
+                            // known after a first pass; NULL otherwise
+    uint64_t *hashes;       // k-mer hashes of the batch being scored, packed
+                            // and mixed k-mers with the exact engine
+    uint8_t *plats;         // exact engine: platter of each k-mer
+    uint8_t *fresh;         // exact engine: whether each k-mer was new to it
+    size_t hashes_m;
+    size_t *offs;           // first hash of each read, n + 1 entries
+    size_t *picked;         // hashes kept of each read, n entries
+    uint8_t *skip;          // why each read isn't scored (STEW_SKIP_*), n entries
+    uint64_t *fps;          // whole-read hashes when skipping duplicates, n entries
+    stew_minhash_t *sigs;   // signatures when skipping near duplicates, n entries
+    size_t offs_m;
+    stew_range_t *ranges;   // long reads of the batch, split up for hashing
+    size_t n_ranges, ranges_m;
+    stew_stats_t stats;
+};
+
+void stew_params_default(stew_params_t *params)
+{
+    params->threads = 1;
+    params->platters = 10;
+    params->cups = 16;
+    params->kmer = 23;
+    params->select = 0.5;
+    params->momentum = 0.000001;
+    params->timing = 0;
+    params->canonical = 0;
+    params->sample = 0;
+    params->sample_arg = 0;
+    params->mask_n = 0;
+    params->min_qual = 0;
+    params->dust = 0;
+    params->dedup_mb = 0;
+    params->near_dup = 0;
+    params->near_dup_max = 1000000;
+    params->engine = STEW_ENGINE_HLL;
+    params->coverage = 20;
+    params->cms_mb = 64;
+    params->cms_bits = 8;
+    params->exact_mb = 1024;
+    params->route = STEW_ROUTE_POS;
+    params->levels = 1;
+    params->level_select[0] = params->select;
+}
+
+stew_ctx_t *stew_ctx_create(const stew_params_t *params)
+{
+    if (params->platters <= 0 || params->platters > STEW_MAX_PLATTERS ||
+        params->cups < STEW_MIN_CUPS || params->cups > STEW_MAX_CUPS ||
+        params->kmer <= 0 || params->kmer > STEW_MAX_KMER || params->threads <= 0 ||
+        params->levels < 1 || params->levels > STEW_MAX_LEVELS ||
+        params->min_qual < 0 || params->min_qual > STEW_MAX_QUAL || !(params->dust >= 0) ||
+        params->dedup_mb < 0 || !(params->near_dup >= 0 && params->near_dup <= 1) ||
+        (params->near_dup > 0 && (params->levels > 1 || params->near_dup_max <= 0)) ||
+        params->engine < STEW_ENGINE_HLL || params->engine > STEW_ENGINE_EXACT ||
+        (params->route != STEW_ROUTE_POS && params->route != STEW_ROUTE_HASH) ||
+        (params->engine == STEW_ENGINE_CMS &&
+         (params->levels > 1 || params->cms_mb <= 0 || (params->cms_bits != 8 && params->cms_bits != 16) ||
+          !(params->coverage > 0 && params->coverage <= (params->cms_bits == 8 ? UINT8_MAX : UINT16_MAX)))) ||
+        (params->engine == STEW_ENGINE_EXACT &&
+         (params->kmer > STEW_EXACT_MAX_KMER || params->sample || params->near_dup > 0 ||
+          params->exact_mb <= 0)) ||
+        !stew_sample_valid(params->sample, params->sample_arg, params->kmer))
+    {
+        return NULL;
+    }
+
+    stew_ctx_t *ctx = (stew_ctx_t *)calloc(1, sizeof(stew_ctx_t));
+    if (!ctx)
+    {
+        return NULL;
+    }
+    ctx->params = *params;
+    // level 0 is the selectivity proper
+    if (params->levels > 1)
+    {
+        ctx->params.select = params->level_select[0];
+    }
+    else
+    {
+        ctx->params.level_select[0] = params->select;
+    }
+    ctx->count = 1;
+    ctx->target = -1;
+    stew_stats_init(&ctx->stats);
+
+    int p = params->platters;
+    ctx->hll = (hll_t **)calloc(p, sizeof(hll_t *));
+    ctx->prev_cnt = (int *)calloc(p, sizeof(int));
+    ctx->curr_cnt = (int *)calloc(p, sizeof(int));
+    ctx->avg = (int *)calloc((size_t)p * params->levels, sizeof(int));
+    if (params->dedup_mb)
+    {
+        ctx->dedup = stew_dedup_create((size_t)params->dedup_mb << 20);
+    }
+    if (params->near_dup > 0)
+    {
+        ctx->lsh = stew_lsh_create(params->near_dup_max);
+    }
+    ctx->engine = stew_engine(params->engine);
+    if (params->engine == STEW_ENGINE_CMS)
+    {
+        ctx->cms = stew_cms_create((size_t)params->cms_mb << 20, params->cms_bits);
+    }
+    if (params->engine == STEW_ENGINE_DELTA)
+    {
+        ctx->hip = (double *)calloc(p, sizeof(double));
+        ctx->harm = (double *)malloc(p * sizeof(double));
+    }
+    if (params->engine == STEW_ENGINE_EXACT)
+    {
+        ctx->exact = stew_exact_create((size_t)params->exact_mb << 20, p);
+        ctx->exact_cnt = (uint64_t *)calloc(p, sizeof(uint64_t));
+    }
+    if (!ctx->hll || !ctx->prev_cnt || !ctx->curr_cnt || !ctx->avg ||
+        (params->dedup_mb && !ctx->dedup) || (params->near_dup > 0 && !ctx->lsh) ||
+        (params->engine == STEW_ENGINE_CMS && !ctx->cms) ||
+        (params->engine == STEW_ENGINE_DELTA && (!ctx->hip || !ctx->harm)) ||
+        (params->engine == STEW_ENGINE_EXACT && (!ctx->exact || !ctx->exact_cnt)))
+    {
+        stew_ctx_destroy(ctx);
+        return NULL;
+    }
+    for (int i = 0; i < p; i++)
+    {
+        if (!(ctx->hll[i] = hll_create(params->cups)))
+        {
+            stew_ctx_destroy(ctx);
+            return NULL;
+        }
+        if (ctx->harm) ctx->harm[i] = (double)((size_t)1 << params->cups); // all registers 0
+    }
+    return ctx;
+}
+
+// kmers per platter of a read, 0 if some platter would get none
+static inline size_t stew_nk(size_t len, int k, int p)
+{
+    return len < (size_t)k ? 0 : (len - k + 1) / p;
+}
+
+// true if a read of effk k-mers is hashed a range at a time, by all threads;
+// reads whose k-mers are filtered or packed are hashed whole
+static inline int stew_split(const stew_ctx_t *ctx, size_t effk)
+{
+    return ctx->params.threads > 1 && effk > STEW_LONG_KMERS &&
+           !stew_kmers_filtered(&ctx->params) && !ctx->exact;
+}
+
+// make room for the hashes of a batch and lay out their offsets
+static int stew_layout(stew_ctx_t *ctx, const size_t *lens, size_t n)
+{
+    if (n + 1 > ctx->offs_m)
+    {
+        size_t *offs = (size_t *)realloc(ctx->offs, (n + 1) * sizeof(size_t));
+        if (!offs) return 0;
+        ctx->offs = offs;
+        size_t *picked = (size_t *)realloc(ctx->picked, (n + 1) * sizeof(size_t));
+        if (!picked) return 0;
+        ctx->picked = picked;
+        uint8_t *skip = (uint8_t *)realloc(ctx->skip, n + 1);
+        if (!skip) return 0;
+        ctx->skip = skip;
+        uint64_t *fps = (uint64_t *)realloc(ctx->fps, (n + 1) * sizeof(uint64_t));
+        if (!fps) return 0;
+        ctx->fps = fps;
+        if (ctx->params.near_dup > 0)
+        {
+            stew_minhash_t *sigs = (stew_minhash_t *)realloc(ctx->sigs, (n + 1) * sizeof(stew_minhash_t));
+            if (!sigs) return 0;
+            ctx->sigs = sigs;
+        }
+        ctx->offs_m = n + 1;
+    }
+
+    size_t total = 0, longest = 0, ranges = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t effk = stew_nk(lens[i], ctx->params.kmer, ctx->params.platters) * ctx->params.platters;
+        ctx->offs[i] = total;
+        total += effk;
+        if (effk > longest) longest = effk;
+        if (stew_split(ctx, effk)) ranges += (effk + STEW_LONG_KMERS - 1) / STEW_LONG_KMERS;
+    }
+    ctx->offs[n] = total;
+    if (ranges > ctx->ranges_m)
+    {
+        stew_range_t *r = (stew_range_t *)realloc(ctx->ranges, ranges * sizeof(stew_range_t));
+        if (!r) return 0;
+        ctx->ranges = r;
+        ctx->ranges_m = ranges;
+    }
+    ctx->n_ranges = 0;
+    for (size_t i = 0; i < n && ranges; i++)
+    {
+        size_t effk = ctx->offs[i + 1] - ctx->offs[i];
+        if (!stew_split(ctx, effk)) continue;
+        for (size_t a = 0; a < effk; a += STEW_LONG_KMERS)
+        {
+            stew_range_t *r = ctx->ranges + ctx->n_ranges++;
+            r->read = i;
+            r->a = a;
+            r->b = a + STEW_LONG_KMERS < effk ? a + STEW_LONG_KMERS : effk;
+        }
+    }
+    if (ctx->cms && longest > ctx->counts_m)
+    {
+        uint32_t *counts = (uint32_t *)realloc(ctx->counts, longest * sizeof(uint32_t));
+        if (!counts) return 0;
+        ctx->counts = counts;
+        ctx->counts_m = longest;
+    }
+
+    if (total > ctx->hashes_m)
+    {
+        uint64_t *hashes = (uint64_t *)realloc(ctx->hashes, total * sizeof(uint64_t));
+        if (!hashes) return 0;
+        ctx->hashes = hashes;
+        if (ctx->exact)
+        {
+            uint8_t *plats = (uint8_t *)realloc(ctx->plats, total);
+            if (!plats) return 0;
+            ctx->plats = plats;
+            uint8_t *fresh = (uint8_t *)realloc(ctx->fresh, total);
+            if (!fresh) return 0;
+            ctx->fresh = fresh;
+        }
+        ctx->hashes_m = total;
+    }
+    return 1;
+}
+
+// add a k-mer to platter i, true if it raised a register. The delta engine
+// counts 1 / q new k-mers for every raise, q = harm / registers being the
+// chance a k-mer never seen would raise one; harm holds dyadic fractions
+// down to 2^-33, so it stays exact.
+static inline int stew_add_hash(stew_ctx_t *ctx, int i, uint64_t hash)
+{
+    if (!ctx->hip)
+    {
+        return hll_add_hash(ctx->hll[i], hash) != 0;
+    }
+    uint8_t prev, gain = hll_add_hash_rank(ctx->hll[i], hash, &prev);
+    if (gain)
+    {
+        ctx->hip[i] += (double)((size_t)1 << ctx->params.cups) / ctx->harm[i];
+        ctx->harm[i] -= ldexp(1, -prev) - ldexp(1, -(prev + gain));
+    }
+    return gain != 0;
+}
+
+// calibrated scoring stops boosting new k-mers once a platter is within this
+// fraction of its final cardinality
+#define STEW_CALIB_MIN_LEFT 0.05f
+
+// score one read from the distinct k-mers now in each platter, in
+// curr_cnt, at every selectivity level. Every read goes into the platters
+// whether it is kept or not, so the platters and counts are the same at all
+// levels; only the running averages, and so the scores, depend on the
+// selectivity.
+static void stew_score_counts(stew_ctx_t *ctx, size_t _nk, float *scores)
+{
+    int p = ctx->params.platters;
+    float m = ctx->params.momentum;
+    double count = (double)ctx->count; // may be past 2^31 after a warm start
+    int *prev_cnt = ctx->prev_cnt, *curr_cnt = ctx->curr_cnt;
+    uint64_t t0 = ctx->params.timing ? stew_now_ns() : 0;
+    long sum_curr = 0;
+    size_t corr = 0;
+    int diff_cnt = 0;
+    float gain[STEW_MAX_PLATTERS];
+
+    if (_nk < ctx->max_nk) // is this the largest number of kmers?
+    {
+        corr = ctx->max_nk - _nk; // no? apply corrections
+    }
+    else
+    {
+        ctx->max_nk = _nk; // yes? assign max
+    }
+
+    for (int i = 0; i < p; i++)
+    {
+        sum_curr += curr_cnt[i];
+    }
+    if (ctx->card) // weigh new k-mers by how hard they are to come by by now
+    {
+        for (int i = 0; i < p; i++)
+        {
+            float left = 1 - curr_cnt[i] / ctx->card[i];
+            gain[i] = 1 / (left > STEW_CALIB_MIN_LEFT ? left : STEW_CALIB_MIN_LEFT);
+        }
+    }
+    for (int l = 0; l < ctx->params.levels; l++)
+    {
+        float x = ctx->params.level_select[l];
+        int *avg = ctx->avg + l * p;
+        float score = 0.0, corr_cnt = 0.0;
+
+        // split loop - may lead to lesser cache misses
+        for (int i = 0; i < p; i++)
+        {
+            diff_cnt = curr_cnt[i] - prev_cnt[i];
+            corr_cnt  = (ctx->card ? diff_cnt * gain[i] : diff_cnt) +
+                        x*((corr/p)+(1-x)*avg[i]+m*count);
+            // corrections added to unique kmers
+            avg[i] = ((double)avg[i]*(count-1) + corr_cnt) / count;
+            score += (corr_cnt / _nk) * curr_cnt[i];
+        }
+        scores[l] = score / sum_curr; // normalize
+    }
+    for (int i = 0; i < p; i++)
+    {
+        prev_cnt[i] = curr_cnt[i];
+    }
+
+    if (ctx->params.timing)
+    {
+        ctx->stats.stage_ns[STEW_STAGE_SCORE] += stew_now_ns() - t0;
+    }
+}
+
+// add a read's precomputed hashes to the platters and score it from their
+// estimates. Filtered hashes, and those routed by hash, carry their
+// platter; the others are _nk to a platter in order. The platters of a long
+// read are shared out among the threads, each adding the k-mers of its own
+// platters in read order, so the registers and the delta engine's counts
+// come out as they would on one thread.
+static void stew_score_read(stew_ctx_t *ctx, const uint64_t *hashes, size_t n_hashes, size_t _nk,
+                            float *scores)
+{
+    int p = ctx->params.platters;
+    int *curr_cnt = ctx->curr_cnt;
+    int timing = ctx->params.timing;
+    uint64_t *stage_ns = ctx->stats.stage_ns;
+    uint64_t t0 = timing ? stew_now_ns() : 0, t1 = 0;
+    size_t _effk = _nk * p; // effective kmers
+    uint64_t updates = 0;
+    int split = ctx->params.threads > 1 && n_hashes > STEW_LONG_KMERS;
+
+    if (stew_kmers_routed(&ctx->params) && split)
+    {
+#pragma omp parallel num_threads(ctx->params.threads) reduction(+:updates)
+        {
+            unsigned part = omp_get_thread_num(), parts = omp_get_num_threads();
+            for (size_t _s = 0; _s < n_hashes; _s++)
+            {
+                unsigned _p = hashes[_s] >> 32;
+                if (_p % parts == part) updates += stew_add_hash(ctx, _p, hashes[_s]);
+            }
+        }
+    }
+    else if (stew_kmers_routed(&ctx->params))
+    {
+        for (size_t _s = 0; _s < n_hashes; _s++)
+        {
+            updates += stew_add_hash(ctx, hashes[_s] >> 32, hashes[_s]);
+        }
+    }
+    else if (split)
+    {
+#pragma omp parallel for num_threads(ctx->params.threads) reduction(+:updates) schedule(static)
+        for (int _p = 0; _p < p; _p++)
+        {
+            for (size_t _s = _p * _nk; _s < (_p + 1) * _nk; _s++)
+            {
+                updates += stew_add_hash(ctx, _p, hashes[_s]);
+            }
+        }
+    }
+    else
+    {
+        int _p = -1;
+        for (size_t _s = 0; _s < _effk; _s++) // add kmers to HLL
+        {
+            if (!(_s % _nk)) _p++;
+            updates += stew_add_hash(ctx, _p, hashes[_s]);
+        }
+    }
+    ctx->stats.register_updates += updates;
+    if (timing)
+    {
+        t1 = stew_now_ns();
+        stage_ns[STEW_STAGE_KMERIZE] += t1 - t0;
+        t0 = t1;
+    }
+
+    for (int i = 0; i < p; i++) // estimate the count and calculate the uniqueness score
+    {
+        if (ctx->hip)
+        {
+            curr_cnt[i] = (int)ctx->hip[i];
+            continue;
+        }
+        hll_estimate_t estimate;
+        hll_get_estimate(ctx->hll[i], &estimate);
+        curr_cnt[i] = estimate.estimate;
+    }
+    if (timing)
+    {
+        stage_ns[STEW_STAGE_ESTIMATE] += stew_now_ns() - t0;
+    }
+    stew_score_counts(ctx, _nk, scores);
+}
+
+// add the k-mers of a hashed batch to the exact sets, each thread to the
+// shards it owns, in read order. The reads scored are known by now: the
+// same as those the score loop goes through.
+static void stew_exact_batch(stew_ctx_t *ctx, size_t n)
+{
+#pragma omp parallel num_threads(ctx->params.threads)
+    {
+        int part = omp_get_thread_num(), parts = omp_get_num_threads();
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t o = ctx->offs[i];
+            if (ctx->skip[i] || !ctx->picked[i]) continue;
+            stew_exact_insert(ctx->exact, ctx->hashes + o, ctx->plats + o, ctx->picked[i], part, parts,
+                              ctx->fresh + o);
+        }
+    }
+}
+
+// count the k-mers of the read new to their platter's set; those that
+// found no room can't be told from the ones seen before
+static void stew_exact_score(stew_ctx_t *ctx, const uint64_t *hashes, size_t n_hashes, size_t _nk,
+                             float *scores)
+{
+    size_t o = hashes - ctx->hashes;
+    uint64_t unstored = 0;
+    for (size_t j = 0; j < n_hashes; j++)
+    {
+        ctx->exact_cnt[ctx->plats[o + j]] += ctx->fresh[o + j] == 1;
+        unstored += ctx->fresh[o + j] == 2;
+    }
+    ctx->stats.kmers_unstored += unstored;
+    for (int i = 0; i < ctx->params.platters; i++)
+    {
+        ctx->curr_cnt[i] = (int)ctx->exact_cnt[i];
+    }
+    stew_score_counts(ctx, _nk, scores);
+}
+
+// median abundance of the read's k-mers, against the cap
+static void stew_cms_score(stew_ctx_t *ctx, const uint64_t *hashes, size_t n_hashes, size_t _nk,
+                           float *scores)
+{
+    (void)_nk;
+    uint64_t t0 = ctx->params.timing ? stew_now_ns() : 0;
+    scores[0] = 1 - stew_cms_median(ctx->cms, hashes, n_hashes, ctx->counts) / ctx->params.coverage;
+    if (ctx->params.timing)
+    {
+        ctx->stats.stage_ns[STEW_STAGE_ESTIMATE] += stew_now_ns() - t0;
+    }
+}
+
+// only what is kept counts towards coverage
+static void stew_cms_decided(stew_ctx_t *ctx, const uint64_t *hashes, size_t n_hashes, int keep)
+{
+    if (keep)
+    {
+        stew_cms_add(ctx->cms, hashes, n_hashes);
+    }
+}
+
+static const stew_engine_t stew_engines[] = {
+        [STEW_ENGINE_HLL] = { stew_score_read, NULL, NULL },
+        [STEW_ENGINE_CMS] = { stew_cms_score, stew_cms_decided, NULL },
+        [STEW_ENGINE_DELTA] = { stew_score_read, NULL, NULL },
+        [STEW_ENGINE_EXACT] = { stew_exact_score, NULL, stew_exact_batch },
+};
+
+static const stew_engine_t *stew_engine(int engine)
+{
+    return stew_engines + engine;
+}
+
+// k-th smallest of n scores, reorders them (Wirth's selection)
+static float stew_kth(float *v, size_t n, size_t k)
+{
+    long lo = 0, hi = (long)n - 1;
+    while (lo < hi)
+    {
+        float x = v[k];
+        long i = lo, j = hi;
+        do
+        {
+            while (v[i] < x) i++;
+            while (x < v[j]) j--;
+            if (i <= j)
+            {
+                float t = v[i];
+                v[i++] = v[j];
+                v[j--] = t;
+            }
+        } while (i <= j);
+        if (j < (long)k) lo = i;
+        if ((long)k < i) hi = j;
+    }
+    return v[k];
+}
+
+// pick the threshold that keeps the fraction target of the recent scores,
+// plus whatever makes up a shortfall of behind reads over the horizon
+static void stew_target_update(stew_ctx_t *ctx, double behind)
+{
+    double f = ctx->target + behind / STEW_TARGET_HORIZON;
+    if (f >= 1 || f <= 0)
+    {
+        ctx->thr = f >= 1 ? -INFINITY : INFINITY;
+        return;
+    }
+    size_t n = ctx->n_scores < STEW_TARGET_WINDOW ? (size_t)ctx->n_scores : STEW_TARGET_WINDOW;
+    float v[STEW_TARGET_WINDOW];
+    memcpy(v, ctx->recent, n * sizeof(float));
+    size_t k = (size_t)((1 - f) * n);
+    ctx->thr = stew_kth(v, n, k < n ? k : n - 1);
+}
+
+// decide on a scored read. In target mode the shortfall is the reads
+// selected against the fraction target of those passed so far; it moves
+// the quantile the threshold is taken at and breaks ties on it, and past
+// the slack overrides the scores, so that the selections stay on track
+// when the scores drift faster than the recent ones follow.
+static int stew_keep(stew_ctx_t *ctx, float score)
+{
+    if (ctx->max_selected && ctx->stats.reads_out >= ctx->max_selected)
+    {
+        return 0;
+    }
+    if (ctx->target < 0)
+    {
+        return score > ctx->params.select;
+    }
+    if (isnan(score))
+    {
+        return 0;
+    }
+    double behind = ctx->target * (ctx->tgt_seen + 1) - ctx->tgt_kept; // this read included
+    ctx->recent[ctx->n_scores++ % STEW_TARGET_WINDOW] = score;
+    if (ctx->n_scores % STEW_TARGET_EVERY == 0)
+    {
+        stew_target_update(ctx, behind);
+    }
+    int keep;
+    if (ctx->target >= 1)
+    {
+        keep = 1;
+    }
+    else if (ctx->n_scores < STEW_TARGET_EVERY) // too few scores for a quantile
+    {
+        keep = behind > 0;
+    }
+    else if (behind >= STEW_TARGET_SLACK || behind <= -STEW_TARGET_SLACK)
+    {
+        keep = behind > 0;
+    }
+    else
+    {
+        keep = score > ctx->thr || (score == ctx->thr && behind > 0);
+    }
+    ctx->tgt_kept += keep;
+    return keep;
+}
+
+void stew_ctx_set_target(stew_ctx_t *ctx, double fraction)
+{
+    if (fraction >= 0 && ctx->target < 0) // start counting afresh
+    {
+        ctx->tgt_seen = ctx->tgt_kept = 0;
+        ctx->n_scores = 0;
+        ctx->thr = ctx->params.select;
+    }
+    ctx->target = fraction < 0 ? -1 : fraction > 1 ? 1 : fraction;
+}
+
+void stew_ctx_set_max_selected(stew_ctx_t *ctx, uint64_t max)
+{
+    ctx->max_selected = max;
+}
+
+double stew_ctx_threshold(const stew_ctx_t *ctx)
+{
+    return ctx->target < 0 ? ctx->params.select : ctx->thr;
+}
+
+// reads left unscored
+enum {
+    STEW_SKIP_NONE,
+    STEW_SKIP_DUST,     // low complexity
+    STEW_SKIP_DUP       // exact copy of a read seen before
+};
+
+// score n reads, or pairs when seqs2 is set
+static long stew_score(stew_ctx_t *ctx, const char *const *seqs, const char *const *quals,
+                       const size_t *lens, const char *const *seqs2, const size_t *lens2,
+                       size_t n, uint8_t *keep_mask)
+{
+    if (!ctx || (n && (!seqs || !lens || !keep_mask)))
+    {
+        return -1;
+    }
+    if (!stew_layout(ctx, lens, n))
+    {
+        return -1;
+    }
+
+    int k = ctx->params.kmer;
+    // packed k-mers of ACGT only are filtered like masked hashes
+    int filtered = stew_kmers_filtered(&ctx->params) || ctx->exact;
+    float dust = ctx->params.dust;
+    int trace = stew_trace_enabled();
+    int failed = 0;
+    uint64_t batch = ctx->batches++;
+    uint64_t t0 = ctx->params.timing || trace ? stew_now_ns() : 0;
+    // reads a thread takes at a time, fewer as they get longer
+    size_t chunk = ctx->offs[n] > STEW_LONG_KMERS / 64 * n ? n * STEW_LONG_KMERS / ctx->offs[n] : 64;
+    if (!chunk) chunk = 1;
+
+    // kmerize - hashing is independent per read, only the platter updates
+    // below have to follow read order
+#pragma omp parallel num_threads(ctx->params.threads)
+    {
+        uint64_t w0 = 0;
+        if (trace)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "hash worker %d", omp_get_thread_num());
+            stew_trace_thread_name(name);
+            w0 = stew_now_ns();
+        }
+        if (ctx->dedup) // only the first copy of a read gets hashed and scored
+        {
+#pragma omp for schedule(static)
+            for (size_t i = 0; i < n; i++)
+            {
+                ctx->fps[i] = stew_dedup_hash(seqs[i], lens[i], seqs2 ? seqs2[i] : NULL,
+                                              seqs2 ? lens2[i] : 0);
+            }
+#pragma omp single
+            for (size_t i = 0; i < n; i++)
+            {
+                ctx->skip[i] = stew_dedup_test_add(ctx->dedup, ctx->fps[i]) ? STEW_SKIP_DUP : STEW_SKIP_NONE;
+            }
+        }
+        uint64_t *valid = NULL; // masks of a read
+        size_t valid_m = 0;
+#pragma omp for schedule(dynamic, chunk) nowait
+        for (size_t i = 0; i < n; i++)
+        {
+            uint64_t *h = ctx->hashes + ctx->offs[i];
+            size_t effk = ctx->offs[i + 1] - ctx->offs[i];
+            if (!ctx->dedup || !ctx->skip[i])
+            {
+                // turned away before hashing, so garbage costs a pass over its bases
+                ctx->skip[i] = effk && dust > 0 && stew_dust_score(seqs[i], lens[i]) > dust ?
+                               STEW_SKIP_DUST : STEW_SKIP_NONE;
+            }
+            ctx->picked[i] = ctx->skip[i] ? 0 : effk;
+            if (ctx->skip[i]) continue;
+            if (filtered)
+            {
+                size_t nk = effk / ctx->params.platters;
+                size_t words = stew_kmers_scratch(&ctx->params, nk);
+                ctx->picked[i] = 0;
+                if (!effk) continue;
+                if (words > valid_m)
+                {
+                    uint64_t *b = (uint64_t *)realloc(valid, words * sizeof(uint64_t));
+                    if (!b)
+                    {
+#pragma omp atomic write
+                        failed = 1;
+                        continue;
+                    }
+                    valid = b;
+                    valid_m = words;
+                }
+                const char *qual = quals ? quals[i] : NULL;
+                if (ctx->exact) // keys for the sets, see exact.h
+                {
+                    ctx->picked[i] = stew_kmers_pack(&ctx->params, seqs[i], qual, nk, valid, h,
+                                                     ctx->plats + ctx->offs[i]);
+                    for (size_t j = 0; j < ctx->picked[i]; j++) h[j] = stew_fmix64(h[j]);
+                    memset(ctx->fresh + ctx->offs[i], 0, ctx->picked[i]);
+                }
+                else
+                {
+                    ctx->picked[i] = stew_kmers_pick(&ctx->params, seqs[i], qual, nk, valid, h);
+                }
+            }
+            else if (stew_split(ctx, effk))
+            {
+                continue; // hashed a range at a time below
+            }
+            else
+            {
+                stew_kmers_hash_range(&ctx->params, seqs[i], effk / ctx->params.platters, 0, effk, h);
+            }
+            if (ctx->lsh) // while the hashes are still in cache
+            {
+                stew_minhash_sign(h, ctx->picked[i], ctx->sigs + i);
+            }
+        }
+        if (ctx->n_ranges) // long reads, once the ones turned away are known
+        {
+#pragma omp barrier
+#pragma omp for schedule(dynamic, 1)
+            for (size_t r = 0; r < ctx->n_ranges; r++)
+            {
+                const stew_range_t *rg = ctx->ranges + r;
+                size_t i = rg->read;
+                if (ctx->skip[i]) continue;
+                stew_kmers_hash_range(&ctx->params, seqs[i], (ctx->offs[i + 1] - ctx->offs[i]) /
+                                      ctx->params.platters, rg->a, rg->b, ctx->hashes + ctx->offs[i]);
+            }
+            if (ctx->lsh)
+            {
+#pragma omp for schedule(dynamic, 1) nowait
+                for (size_t r = 0; r < ctx->n_ranges; r++)
+                {
+                    size_t i = ctx->ranges[r].read;
+                    if (ctx->ranges[r].a || ctx->skip[i]) continue;
+                    stew_minhash_sign(ctx->hashes + ctx->offs[i], ctx->picked[i], ctx->sigs + i);
+                }
+            }
+        }
+        if (trace) // one span per worker, the gaps before the barrier are imbalance
+        {
+            stew_trace_span("hash", w0, stew_now_ns(), "batch", batch);
+        }
+        free(valid);
+    }
+    if (failed)
+    {
+        return -1;
+    }
+    size_t hashed = 0;
+    for (size_t i = 0; i < n; i++) hashed += ctx->picked[i];
+    stew_stats_add(&ctx->stats.kmers_hashed, hashed);
+    if (ctx->engine->batch)
+    {
+        ctx->engine->batch(ctx, n);
+    }
+    uint64_t t1 = ctx->params.timing || trace ? stew_now_ns() : 0;
+    if (ctx->params.timing)
+    {
+        ctx->stats.stage_ns[STEW_STAGE_KMERIZE] += t1 - t0;
+    }
+
+    long kept = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t _nk = stew_nk(lens[i], k, ctx->params.platters);
+        size_t n_hashes = ctx->offs[i + 1] - ctx->offs[i];
+        if (filtered && _nk) // k-mers per platter of what was picked, 0 if none
+        {
+            n_hashes = ctx->picked[i];
+            _nk = stew_sample_nk(n_hashes, ctx->params.platters);
+        }
+        if (ctx->skip[i])
+        {
+            _nk = 0;
+            stew_stats_add(ctx->skip[i] == STEW_SKIP_DUST ? &ctx->stats.reads_dusted :
+                           &ctx->stats.reads_duplicate, 1);
+        }
+        // too short to give every platter a kmer, nothing to score
+        keep_mask[i] = 0;
+        if (_nk)
+        {
+            float scores[STEW_MAX_LEVELS];
+            const uint64_t *hashes = ctx->hashes + ctx->offs[i];
+            ctx->engine->score(ctx, hashes, n_hashes, _nk, scores);
+            // a read much like one selected already is left out before the
+            // threshold sees it, so target mode only counts reads it decides on
+            if (ctx->lsh && stew_lsh_query(ctx->lsh, ctx->sigs + i, ctx->params.near_dup))
+            {
+                stew_stats_add(&ctx->stats.reads_near_duplicate, 1);
+            }
+            else
+            {
+                keep_mask[i] = stew_keep(ctx, scores[0]);
+                if (ctx->lsh && keep_mask[i])
+                {
+                    stew_lsh_add(ctx->lsh, ctx->sigs + i);
+                }
+            }
+            if (ctx->engine->decided)
+            {
+                ctx->engine->decided(ctx, hashes, n_hashes, keep_mask[i] & 1);
+            }
+            for (int l = 1; l < ctx->params.levels; l++)
+            {
+                int keep_l = scores[l] > ctx->params.level_select[l];
+                keep_mask[i] |= keep_l << l;
+                ctx->level_selected[l] += keep_l;
+            }
+        }
+        kept += keep_mask[i] & 1;
+        ctx->tgt_seen += ctx->target >= 0;
+        ctx->count++;
+        // per read, so progress reports don't stall on long batches
+        stew_stats_add(&ctx->stats.reads_in, 1);
+        stew_stats_add(&ctx->stats.reads_out, keep_mask[i] & 1);
+    }
+    if (trace) // platter updates, estimates and scores run in read order
+    {
+        stew_trace_span("score", t1, stew_now_ns(), "batch", batch);
+    }
+    return kept;
+}
+
+long stew_score_batch(stew_ctx_t *ctx, const char *const *seqs, const size_t *lens,
+                      size_t n, uint8_t *keep_mask)
+{
+    return stew_score(ctx, seqs, NULL, lens, NULL, NULL, n, keep_mask);
+}
+
+long stew_score_batch_qual(stew_ctx_t *ctx, const char *const *seqs, const char *const *quals,
+                           const size_t *lens, size_t n, uint8_t *keep_mask)
+{
+    return stew_score(ctx, seqs, quals, lens, NULL, NULL, n, keep_mask);
+}
+
+long stew_score_batch_pairs(stew_ctx_t *ctx, const char *const *seqs, const char *const *quals,
+                            const size_t *lens, const char *const *seqs2, const size_t *lens2,
+                            size_t n, uint8_t *keep_mask)
+{
+    if (n && (!seqs2 || !lens2))
+    {
+        return -1;
+    }
+    return stew_score(ctx, seqs, quals, lens, seqs2, lens2, n, keep_mask);
+}
+
+uint64_t stew_ctx_seen(const stew_ctx_t *ctx)
+{
+    return ctx->stats.reads_in;
+}
+
+uint64_t stew_ctx_selected(const stew_ctx_t *ctx)
+{
+    return ctx->stats.reads_out;
+}
+
+uint64_t stew_ctx_selected_level(const stew_ctx_t *ctx, int level)
+{
+    return level ? ctx->level_selected[level] : ctx->stats.reads_out;
+}
+
+stew_sketch_t *stew_ctx_sketch(const stew_ctx_t *ctx)
+{
+    int p = ctx->params.platters;
+    stew_sketch_t *sk = stew_sketch_create(ctx->params.kmer, p, ctx->params.cups);
+    if (!sk)
+    {
+        return NULL;
+    }
+    sk->hash_id = stew_sketch_hash_id(&ctx->params);
+    sk->flags = stew_sketch_flags(&ctx->params);
+    for (int i = 0; i < p; i++)
+    {
+        size_t n_buckets;
+        const uint8_t *regs = hll_buckets(ctx->hll[i], &n_buckets);
+        memcpy(stew_sketch_platter(sk, i), regs, n_buckets);
+    }
+    sk->max_nk = ctx->max_nk < UINT32_MAX ? (uint32_t)ctx->max_nk : UINT32_MAX;
+    sk->n_reads = ctx->stats.reads_in;
+    sk->n_kmers = ctx->stats.kmers_hashed;
+    return sk;
+}
+
+// whether the engine keeps its k-mers in the platters, as sketches do
+static inline int stew_uses_platters(const stew_ctx_t *ctx)
+{
+    return ctx->params.engine == STEW_ENGINE_HLL || ctx->params.engine == STEW_ENGINE_DELTA;
+}
+
+// recompute the delta engine's harm from registers set wholesale
+static void stew_harm_sync(stew_ctx_t *ctx)
+{
+    for (int i = 0; ctx->harm && i < ctx->params.platters; i++)
+    {
+        size_t n_buckets;
+        const uint8_t *regs = hll_buckets(ctx->hll[i], &n_buckets);
+        double harm = 0;
+        for (size_t j = 0; j < n_buckets; j++) harm += ldexp(1, -regs[j]);
+        ctx->harm[i] = harm;
+    }
+}
+
+// seed the running counts with what the platters now hold, so that
+// preloaded content doesn't count as novelty
+static void stew_reseed(stew_ctx_t *ctx)
+{
+    for (int i = 0; i < ctx->params.platters; i++)
+    {
+        hll_estimate_t estimate;
+        hll_get_estimate(ctx->hll[i], &estimate);
+        ctx->prev_cnt[i] = estimate.estimate;
+        if (ctx->hip) ctx->hip[i] = estimate.estimate;
+    }
+    stew_harm_sync(ctx);
+}
+
+int stew_ctx_preload(stew_ctx_t *ctx, const stew_sketch_t *sk)
+{
+    int cups = ctx->params.cups;
+    size_t n_buckets = (size_t)1 << cups;
+    if (!stew_uses_platters(ctx) || sk->hash_id != stew_sketch_hash_id(&ctx->params) ||
+        sk->flags != stew_sketch_flags(&ctx->params) || (int)sk->kmer != ctx->params.kmer ||
+        (int)sk->cups != cups)
+    {
+        return 0;
+    }
+    if (ctx->params.route == STEW_ROUTE_HASH) // a k-mer goes to the same platter in any read
+    {
+        if ((int)sk->platters != ctx->params.platters)
+        {
+            return 0;
+        }
+        for (int i = 0; i < ctx->params.platters; i++)
+        {
+            hll_merge_buckets(hll_buckets(ctx->hll[i], NULL), stew_sketch_platter(sk, i), n_buckets);
+        }
+        stew_reseed(ctx);
+        return 1;
+    }
+    uint8_t *bg = (uint8_t *)calloc(n_buckets, 1);
+    if (!bg)
+    {
+        return 0;
+    }
+    for (uint32_t j = 0; j < sk->platters; j++)
+    {
+        hll_merge_buckets(bg, stew_sketch_platter(sk, j), n_buckets);
+    }
+    for (int i = 0; i < ctx->params.platters; i++)
+    {
+        hll_merge_buckets(hll_buckets(ctx->hll[i], NULL), bg, n_buckets);
+    }
+    free(bg);
+    stew_reseed(ctx);
+    return 1;
+}
+
+int stew_ctx_calibrate(stew_ctx_t *ctx, const stew_sketch_t *sk)
+{
+    int p = ctx->params.platters;
+    size_t n_buckets = (size_t)1 << ctx->params.cups;
+    if (!stew_uses_platters(ctx) || !stew_sketch_compatible(sk, &ctx->params))
+    {
+        return 0;
+    }
+    float *card = ctx->card ? ctx->card : (float *)malloc(p * sizeof(float));
+    hll_t *hll = hll_create(ctx->params.cups);
+    if (!card || !hll)
+    {
+        if (card != ctx->card) free(card);
+        hll_release(hll);
+        return 0;
+    }
+    // the platters end up with what they hold now plus all of the input
+    for (int i = 0; i < p; i++)
+    {
+        hll_estimate_t estimate;
+        uint8_t *regs = hll_buckets(hll, NULL);
+        memcpy(regs, hll_buckets(ctx->hll[i], NULL), n_buckets);
+        hll_merge_buckets(regs, stew_sketch_platter(sk, i), n_buckets);
+        hll_get_estimate(hll, &estimate);
+        card[i] = estimate.estimate > 1 ? estimate.estimate : 1;
+    }
+    hll_release(hll);
+    ctx->card = card;
+    if (sk->max_nk > ctx->max_nk)
+    {
+        ctx->max_nk = sk->max_nk;
+    }
+    return 1;
+}
+
+int stew_ctx_warm_start(stew_ctx_t *ctx, const stew_sketch_t *sk)
+{
+    if (!stew_uses_platters(ctx) || !stew_sketch_compatible(sk, &ctx->params))
+    {
+        return 0;
+    }
+    for (int i = 0; i < ctx->params.platters; i++)
+    {
+        hll_merge_buckets(hll_buckets(ctx->hll[i], NULL), stew_sketch_platter(sk, i),
+                          (size_t)1 << ctx->params.cups);
+    }
+    stew_reseed(ctx);
+    if (sk->max_nk > ctx->max_nk)
+    {
+        ctx->max_nk = sk->max_nk;
+    }
+    ctx->count += sk->n_reads;
+    return 1;
+}
+
+stew_stats_t *stew_ctx_stats(stew_ctx_t *ctx)
+{
+    return &ctx->stats;
+}
+
+#define STEW_STATE_MAGIC "STEWSTAT"
+#define STEW_STATE_VERSION 13
+#define STEW_STATE_HEADER 248
+#define STEW_STATE_CALIBRATED 0x1
+#define STEW_STATE_CANONICAL 0x2
+#define STEW_STATE_MASK_N 0x4
+#define STEW_STATE_ROUTE_HASH 0x8
+// bits 8-15: subsampling, 16-23: its argument, 24-31: least base quality
+
+static uint32_t stew_state_flags(const stew_ctx_t *ctx)
+{
+    return (ctx->card ? STEW_STATE_CALIBRATED : 0) |
+           (ctx->params.canonical ? STEW_STATE_CANONICAL : 0) |
+           (ctx->params.mask_n ? STEW_STATE_MASK_N : 0) |
+           (ctx->params.route == STEW_ROUTE_HASH ? STEW_STATE_ROUTE_HASH : 0) |
+           (uint32_t)ctx->params.sample << 8 | (uint32_t)ctx->params.sample_arg << 16 |
+           (uint32_t)ctx->params.min_qual << 24;
+}
+
+size_t stew_ctx_state_size(const stew_ctx_t *ctx)
+{
+    int p = ctx->params.platters;
+    int levels = ctx->params.levels;
+    return STEW_STATE_HEADER + (size_t)p * (2 + levels) * sizeof(uint32_t) +
+           (size_t)(levels - 1) * sizeof(uint64_t) + (ctx->hip ? (size_t)p * sizeof(double) : 0) +
+           STEW_TARGET_WINDOW * sizeof(float) +
+           (ctx->dedup ? stew_dedup_state_size(ctx->dedup) : 0) +
+           (ctx->lsh ? stew_lsh_state_size(ctx->lsh) : 0) +
+           (ctx->cms ? stew_cms_state_size(ctx->cms) : 0) +
+           (ctx->exact ? stew_exact_state_size(ctx->exact) : 0) + ((size_t)p << ctx->params.cups);
+}
+
+//   header: magic, version, k, platters, cups, select, momentum, count (64
+//           bits), batches, reads in/out, k-mers hashed, register updates,
+//           target mode: target, max selected, threshold, reads passed and
+//           kept, scores seen, the number of levels, flags (calibrated,
+//           canonical k-mers, hash routing, subsampling, masking), the
+//           selectivities of the levels, the DUST threshold and the reads it
+//           rejected, the duplicates skipped and the size of their table,
+//           the near duplicates left out, their similarity and signature
+//           cap, the engine and its coverage cap, the k-mers the exact
+//           engine had no room for, and max_nk as 64 bits
+//   then prev_cnt[platters], avg[levels][platters], the selections of
+//   levels 1 and up, card[platters] (0 when not calibrated), the new k-mers
+//   counted into each platter by the delta engine, the recent scores of
+//   target mode, the table of reads seen when skipping duplicates, the
+//   signatures of the reads selected when skipping near duplicates, the
+//   k-mer counts of the cms engine, the k-mer sets of the exact engine, and
+//   the registers of each platter
+int stew_ctx_state_write(const stew_ctx_t *ctx, le_writer_t *w)
+{
+    int p = ctx->params.platters;
+    uint8_t buf[STEW_STATE_HEADER] = { 0 };
+    memcpy(buf, STEW_STATE_MAGIC, 8);
+    le_put_u32(buf + 8, STEW_STATE_VERSION);
+    le_put_u32(buf + 12, ctx->params.kmer);
+    le_put_u32(buf + 16, p);
+    le_put_u32(buf + 20, ctx->params.cups);
+    le_put_f32(buf + 24, ctx->params.select);
+    le_put_f32(buf + 28, ctx->params.momentum);
+    le_put_u64(buf + 32, ctx->count);
+    le_put_u64(buf + 40, ctx->batches);
+    le_put_u64(buf + 48, ctx->stats.reads_in);
+    le_put_u64(buf + 56, ctx->stats.reads_out);
+    le_put_u64(buf + 64, ctx->stats.kmers_hashed);
+    le_put_u64(buf + 72, ctx->stats.register_updates);
+    le_put_f64(buf + 80, ctx->target);
+    le_put_u64(buf + 88, ctx->max_selected);
+    le_put_f64(buf + 96, ctx->thr);
+    le_put_u64(buf + 104, ctx->tgt_seen);
+    le_put_u64(buf + 112, ctx->tgt_kept);
+    le_put_u64(buf + 120, ctx->n_scores);
+    le_put_u32(buf + 136, ctx->params.levels);
+    le_put_u32(buf + 140, stew_state_flags(ctx));
+    for (int l = 0; l < ctx->params.levels; l++) le_put_f32(buf + 144 + 4 * l, ctx->params.level_select[l]);
+    le_put_f32(buf + 176, ctx->params.dust);
+    le_put_u64(buf + 184, ctx->stats.reads_dusted);
+    le_put_u64(buf + 192, ctx->stats.reads_duplicate);
+    le_put_u32(buf + 200, ctx->params.dedup_mb);
+    le_put_u64(buf + 208, ctx->stats.reads_near_duplicate);
+    le_put_f32(buf + 216, ctx->params.near_dup);
+    le_put_u32(buf + 220, ctx->params.near_dup_max);
+    le_put_u32(buf + 224, ctx->params.engine);
+    le_put_f32(buf + 228, ctx->params.coverage);
+    le_put_u64(buf + 232, ctx->stats.kmers_unstored);
+    le_put_u64(buf + 240, ctx->max_nk);
+
+    le_write(w, buf, STEW_STATE_HEADER);
+
+    for (int i = 0; i < p; i++) le_write_u32(w, ctx->prev_cnt[i]);
+    for (int i = 0; i < p * ctx->params.levels; i++) le_write_u32(w, ctx->avg[i]);
+    for (int l = 1; l < ctx->params.levels; l++) le_write_u64(w, ctx->level_selected[l]);
+    for (int i = 0; i < p; i++) le_write_f32(w, ctx->card ? ctx->card[i] : 0);
+    for (int i = 0; ctx->hip && i < p; i++) le_write_f64(w, ctx->hip[i]);
+    for (int i = 0; i < STEW_TARGET_WINDOW; i++) le_write_f32(w, ctx->recent[i]);
+    if (ctx->dedup) stew_dedup_write(ctx->dedup, w);
+    if (ctx->lsh) stew_lsh_write(ctx->lsh, w);
+    if (ctx->cms) stew_cms_write(ctx->cms, w);
+    if (ctx->exact) stew_exact_write(ctx->exact, w);
+    for (int i = 0; i < p; i++)
+    {
+        size_t n_buckets;
+        const uint8_t *regs = hll_buckets(ctx->hll[i], &n_buckets);
+        le_write(w, regs, n_buckets);
+    }
+    return w->ok;
+}
+
+void stew_ctx_state_save(const stew_ctx_t *ctx, uint8_t *buf)
+{
+    le_writer_t w = { NULL, NULL, buf, stew_ctx_state_size(ctx), 0, 1 };
+    stew_ctx_state_write(ctx, &w);
+}
+
+int stew_ctx_state_load(stew_ctx_t *ctx, const uint8_t *buf, size_t len)
+{
+    int p = ctx->params.platters;
+    if (len != stew_ctx_state_size(ctx) || memcmp(buf, STEW_STATE_MAGIC, 8) ||
+        le_get_u32(buf + 8) != STEW_STATE_VERSION ||
+        le_get_u32(buf + 12) != (uint32_t)ctx->params.kmer ||
+        le_get_u32(buf + 16) != (uint32_t)p ||
+        le_get_u32(buf + 20) != (uint32_t)ctx->params.cups ||
+        le_get_f32(buf + 24) != ctx->params.select ||
+        le_get_f32(buf + 28) != ctx->params.momentum ||
+        le_get_u32(buf + 136) != (uint32_t)ctx->params.levels ||
+        le_get_f32(buf + 176) != ctx->params.dust ||
+        le_get_u32(buf + 200) != (uint32_t)ctx->params.dedup_mb ||
+        le_get_f32(buf + 216) != ctx->params.near_dup ||
+        (ctx->lsh && le_get_u32(buf + 220) != (uint32_t)ctx->params.near_dup_max) ||
+        le_get_u32(buf + 224) != (uint32_t)ctx->params.engine ||
+        (ctx->cms && le_get_f32(buf + 228) != ctx->params.coverage) ||
+        (le_get_u32(buf + 140) & ~STEW_STATE_CALIBRATED) !=
+        (stew_state_flags(ctx) & ~STEW_STATE_CALIBRATED))
+    {
+        return 0;
+    }
+    for (int l = 0; l < ctx->params.levels; l++)
+    {
+        if (le_get_f32(buf + 144 + 4 * l) != ctx->params.level_select[l]) return 0;
+    }
+
+    // check the registers before touching the context
+    const uint8_t *regs = buf + len - ((size_t)p << ctx->params.cups);
+    uint8_t max_rank = 33 - ctx->params.cups;
+    for (size_t j = 0; j < ((size_t)p << ctx->params.cups); j++)
+    {
+        if (regs[j] > max_rank) return 0;
+    }
+    const uint8_t *tables = regs - (ctx->exact ? stew_exact_state_size(ctx->exact) : 0);
+    if (ctx->exact && !stew_exact_load(ctx->exact, tables))
+    {
+        return 0;
+    }
+    tables -= ctx->cms ? stew_cms_state_size(ctx->cms) : 0;
+    if (ctx->cms && !stew_cms_load(ctx->cms, tables))
+    {
+        return 0;
+    }
+    tables -= ctx->lsh ? stew_lsh_state_size(ctx->lsh) : 0;
+    if ((ctx->lsh && !stew_lsh_load(ctx->lsh, tables)) ||
+        (ctx->dedup && !stew_dedup_load(ctx->dedup, tables - stew_dedup_state_size(ctx->dedup))))
+    {
+        return 0;
+    }
+    float *card = ctx->card;
+    int calibrated = le_get_u32(buf + 140) & STEW_STATE_CALIBRATED;
+    if (calibrated && !card && !(card = (float *)malloc(p * sizeof(float))))
+    {
+        return 0;
+    }
+
+    ctx->count = le_get_u64(buf + 32);
+    ctx->max_nk = le_get_u64(buf + 240);
+    ctx->batches = le_get_u64(buf + 40);
+    ctx->stats.reads_in = le_get_u64(buf + 48);
+    ctx->stats.reads_out = le_get_u64(buf + 56);
+    ctx->stats.reads_dusted = le_get_u64(buf + 184);
+    ctx->stats.reads_duplicate = le_get_u64(buf + 192);
+    ctx->stats.reads_near_duplicate = le_get_u64(buf + 208);
+    ctx->stats.kmers_hashed = le_get_u64(buf + 64);
+    ctx->stats.register_updates = le_get_u64(buf + 72);
+    ctx->stats.kmers_unstored = le_get_u64(buf + 232);
+    ctx->target = le_get_f64(buf + 80);
+    ctx->max_selected = le_get_u64(buf + 88);
+    ctx->thr = le_get_f64(buf + 96);
+    ctx->tgt_seen = le_get_u64(buf + 104);
+    ctx->tgt_kept = le_get_u64(buf + 112);
+    ctx->n_scores = le_get_u64(buf + 120);
+
+    const uint8_t *b = buf + STEW_STATE_HEADER;
+    for (int i = 0; i < p; i++, b += 4) ctx->prev_cnt[i] = (int)le_get_u32(b);
+    for (int i = 0; i < p * ctx->params.levels; i++, b += 4) ctx->avg[i] = (int)le_get_u32(b);
+    for (int l = 1; l < ctx->params.levels; l++, b += 8) ctx->level_selected[l] = le_get_u64(b);
+    if (calibrated)
+    {
+        for (int i = 0; i < p; i++) card[i] = le_get_f32(b + 4 * i);
+        ctx->card = card;
+    }
+    else
+    {
+        free(ctx->card);
+        ctx->card = NULL;
+    }
+    b += 4 * p;
+    for (int i = 0; ctx->hip && i < p; i++, b += 8) ctx->hip[i] = le_get_f64(b);
+    for (int i = 0; i < STEW_TARGET_WINDOW; i++, b += 4) ctx->recent[i] = le_get_f32(b);
+    b += ctx->dedup ? stew_dedup_state_size(ctx->dedup) : 0; // loaded above
+    b += ctx->lsh ? stew_lsh_state_size(ctx->lsh) : 0;
+    b += ctx->cms ? stew_cms_state_size(ctx->cms) : 0;
+    b += ctx->exact ? stew_exact_state_size(ctx->exact) : 0;
+    for (int i = 0; ctx->exact && i < p; i++) ctx->exact_cnt[i] = stew_exact_count(ctx->exact, i);
+    for (int i = 0; i < p; i++)
+    {
+        size_t n_buckets;
+        uint8_t *dst = hll_buckets(ctx->hll[i], &n_buckets);
+        memcpy(dst, b, n_buckets);
+        b += n_buckets;
+    }
+    stew_harm_sync(ctx);
+    return 1;
+}
+
+stew_ctx_t *stew_ctx_clone(const stew_ctx_t *ctx)
+{
+    int p = ctx->params.platters;
+    stew_ctx_t *c = stew_ctx_create(&ctx->params);
+    if (!c)
+    {
+        return NULL;
+    }
+    if (ctx->card && !(c->card = (float *)malloc(p * sizeof(float))))
+    {
+        stew_ctx_destroy(c);
+        return NULL;
+    }
+    c->max_nk = ctx->max_nk;
+    c->count = ctx->count;
+    c->batches = ctx->batches;
+    c->target = ctx->target;
+    c->max_selected = ctx->max_selected;
+    c->thr = ctx->thr;
+    c->tgt_seen = ctx->tgt_seen;
+    c->tgt_kept = ctx->tgt_kept;
+    c->n_scores = ctx->n_scores;
+    memcpy(c->recent, ctx->recent, sizeof(ctx->recent));
+    memcpy(c->level_selected, ctx->level_selected, sizeof(ctx->level_selected));
+    c->stats = ctx->stats;
+    memcpy(c->prev_cnt, ctx->prev_cnt, p * sizeof(int));
+    memcpy(c->curr_cnt, ctx->curr_cnt, p * sizeof(int));
+    memcpy(c->avg, ctx->avg, (size_t)p * ctx->params.levels * sizeof(int));
+    if (ctx->card) memcpy(c->card, ctx->card, p * sizeof(float));
+    if (ctx->hip) memcpy(c->hip, ctx->hip, p * sizeof(double));
+    if (ctx->harm) memcpy(c->harm, ctx->harm, p * sizeof(double));
+    if (ctx->exact_cnt) memcpy(c->exact_cnt, ctx->exact_cnt, p * sizeof(uint64_t));
+    if (ctx->dedup) stew_dedup_copy(c->dedup, ctx->dedup);
+    if (ctx->lsh) stew_lsh_copy(c->lsh, ctx->lsh);
+    if (ctx->cms) stew_cms_copy(c->cms, ctx->cms);
+    if (ctx->exact) stew_exact_copy(c->exact, ctx->exact);
+    for (int i = 0; i < p; i++)
+    {
+        size_t n_buckets;
+        const uint8_t *regs = hll_buckets(ctx->hll[i], &n_buckets);
+        memcpy(hll_buckets(c->hll[i], NULL), regs, n_buckets);
+    }
+    return c;
+}
+
+void stew_ctx_destroy(stew_ctx_t *ctx)
+{
+    if (!ctx)
+    {
+        return;
+    }
+    if (ctx->hll)
+    {
+        for (int i = 0; i < ctx->params.platters; i++)
+        {
+            hll_release(ctx->hll[i]);
+        }
+    }
+    free(ctx->hll);
+    free(ctx->prev_cnt);
+    free(ctx->curr_cnt);
+    free(ctx->avg);
+    free(ctx->card);
+    free(ctx->hashes);
+    free(ctx->offs);
+    free(ctx->picked);
+    free(ctx->skip);
+    free(ctx->fps);
+    free(ctx->sigs);
+    free(ctx->ranges);
+    stew_lsh_destroy(ctx->lsh);
+    free(ctx->counts);
+    stew_cms_destroy(ctx->cms);
+    free(ctx->hip);
+    free(ctx->harm);
+    stew_exact_destroy(ctx->exact);
+    free(ctx->exact_cnt);
+    free(ctx->plats);
+    free(ctx->fresh);
+    stew_dedup_destroy(ctx->dedup);
+    free(ctx);
+}
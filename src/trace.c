@@ -0,0 +1,152 @@
+//
+// Pipeline tracing in the Chrome trace-event format.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <trace.h>
+
+#define TRACE_MAX_SPANS (1 << 18) // per thread, ~10 MB
+
+typedef struct trace_span_s {
+    const char *name, *arg_name;
+    uint64_t t0, dur, arg;
+} trace_span_t;
+
+// spans of one thread; only that thread appends, buffers are kept for the
+// life of the process so a thread never holds a dangling pointer
+typedef struct trace_buf_s {
+    trace_span_t *spans;
+    size_t n, m;
+    uint64_t dropped;
+    int tid;
+    char name[32];
+    struct trace_buf_s *next;
+} trace_buf_t;
+
+int stew_trace_on;
+static uint64_t trace_start_ns;
+static trace_buf_t *trace_bufs;
+static int trace_n_bufs;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread trace_buf_t *trace_tls;
+
+void stew_trace_start(void)
+{
+    trace_start_ns = stew_now_ns();
+    __atomic_store_n(&stew_trace_on, 1, __ATOMIC_RELEASE);
+}
+
+// the calling thread's buffer, registered on first use
+static trace_buf_t *trace_buf(void)
+{
+    if (trace_tls)
+    {
+        return trace_tls;
+    }
+    trace_buf_t *b = (trace_buf_t *)calloc(1, sizeof(trace_buf_t));
+    if (!b)
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&trace_lock);
+    b->tid = ++trace_n_bufs;
+    b->next = trace_bufs;
+    trace_bufs = b;
+    pthread_mutex_unlock(&trace_lock);
+    return trace_tls = b;
+}
+
+void stew_trace_thread_name(const char *name)
+{
+    trace_buf_t *b = trace_buf();
+    if (b && !b->name[0])
+    {
+        snprintf(b->name, sizeof(b->name), "%s", name);
+    }
+}
+
+void stew_trace_span(const char *name, uint64_t t0, uint64_t t1,
+                     const char *arg_name, uint64_t arg)
+{
+    trace_buf_t *b = trace_buf();
+    if (!b)
+    {
+        return;
+    }
+    if (b->n == b->m)
+    {
+        size_t m = b->m ? b->m << 1 : 1024;
+        trace_span_t *spans = m <= TRACE_MAX_SPANS ?
+                (trace_span_t *)realloc(b->spans, m * sizeof(trace_span_t)) : NULL;
+        if (!spans)
+        {
+            b->dropped++;
+            return;
+        }
+        b->spans = spans;
+        b->m = m;
+    }
+    trace_span_t *s = &b->spans[b->n++];
+    s->name = name;
+    s->arg_name = arg_name;
+    s->t0 = t0;
+    s->dur = t1 - t0;
+    s->arg = arg;
+}
+
+int stew_trace_write(const char *fname)
+{
+    __atomic_store_n(&stew_trace_on, 0, __ATOMIC_RELEASE);
+
+    FILE *fp = fopen(fname, "w");
+    if (!fp)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    fprintf(fp, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, "
+                "\"args\": {\"name\": \"stew\"}}");
+    for (trace_buf_t *b = trace_bufs; b; b = b->next)
+    {
+        fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                    "\"args\": {\"name\": \"%s\"}}",
+                b->tid, b->name[0] ? b->name : "thread");
+        fprintf(fp, ",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                    "\"args\": {\"sort_index\": %d}}", b->tid, b->tid);
+        for (size_t i = 0; i < b->n; i++)
+        {
+            const trace_span_t *s = &b->spans[i];
+            // timestamps are microseconds, relative to the start of tracing
+            fprintf(fp, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                        "\"ts\": %.3f, \"dur\": %.3f",
+                    s->name, b->tid, (double)(int64_t)(s->t0 - trace_start_ns) * 1e-3,
+                    s->dur * 1e-3);
+            if (s->arg_name)
+            {
+                fprintf(fp, ", \"args\": {\"%s\": %llu}", s->arg_name, (unsigned long long)s->arg);
+            }
+            fprintf(fp, "}");
+        }
+        if (b->dropped)
+        {
+            fprintf(fp, ",\n{\"name\": \"spans dropped\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 1, "
+                        "\"tid\": %d, \"ts\": 0, \"args\": {\"count\": %llu}}",
+                    b->tid, (unsigned long long)b->dropped);
+        }
+        free(b->spans);
+        b->spans = NULL;
+        b->n = b->m = 0;
+        b->dropped = 0;
+    }
+    fprintf(fp, "\n]}\n");
+    pthread_mutex_unlock(&trace_lock);
+
+    int ok = !ferror(fp);
+    return (fclose(fp) == 0) && ok;
+}